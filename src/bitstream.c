@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "bitstream.h"
+
+#define BITSTREAM_VECTOR_SIZE		16
+
+static inline bool bitstream_start_code(const uint8_t *p)
+{
+	return p[0] == 0x00 && p[1] == 0x00 && p[2] == 0x01;
+}
+
+static inline void bitstream_found(unsigned int offset, unsigned int *count,
+	unsigned int *first_offset, unsigned int *last_offset)
+{
+	if (*count == 0)
+		*first_offset = offset;
+
+	*last_offset = offset;
+	(*count)++;
+}
+
+/*
+ * Copies the bitstream to the destination, if any, while looking for the
+ * 00 00 01 start code prefixes. Sixteen positions are checked at once by
+ * comparing the vectors loaded at each of the three prefix bytes, which are
+ * then stored as part of the copy. The number of start codes is returned
+ * along with the offsets of the first and last ones.
+ */
+unsigned int bitstream_copy_scan(void *destination, const void *source,
+	unsigned int size, unsigned int *first_offset,
+	unsigned int *last_offset)
+{
+	uint8_t *d = destination;
+	const uint8_t *s = source;
+	unsigned int count = 0;
+	unsigned int offset = 0;
+#if defined(__SSE2__)
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi8(1);
+	__m128i a, b, c;
+	unsigned int mask;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	uint8x16_t zero = vdupq_n_u8(0);
+	uint8x16_t one = vdupq_n_u8(1);
+	uint8x16_t a, b, c, m;
+	uint64x2_t lanes;
+	unsigned int i;
+#endif
+
+	*first_offset = 0;
+	*last_offset = 0;
+
+#if defined(__SSE2__)
+	while (offset + BITSTREAM_VECTOR_SIZE + BITSTREAM_START_CODE_SIZE - 1 <= size) {
+		a = _mm_loadu_si128((const __m128i *) (s + offset));
+		b = _mm_loadu_si128((const __m128i *) (s + offset + 1));
+		c = _mm_loadu_si128((const __m128i *) (s + offset + 2));
+
+		if (d != NULL)
+			_mm_storeu_si128((__m128i *) (d + offset), a);
+
+		mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)), _mm_cmpeq_epi8(c, one)));
+
+		while (mask != 0) {
+			bitstream_found(offset + __builtin_ctz(mask), &count, first_offset, last_offset);
+			mask &= mask - 1;
+		}
+
+		offset += BITSTREAM_VECTOR_SIZE;
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	while (offset + BITSTREAM_VECTOR_SIZE + BITSTREAM_START_CODE_SIZE - 1 <= size) {
+		a = vld1q_u8(s + offset);
+		b = vld1q_u8(s + offset + 1);
+		c = vld1q_u8(s + offset + 2);
+
+		if (d != NULL)
+			vst1q_u8(d + offset, a);
+
+		m = vandq_u8(vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero)), vceqq_u8(c, one));
+		lanes = vreinterpretq_u64_u8(m);
+
+		/* Start codes are rare, so matches are located with scalar code. */
+		if ((vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) != 0)
+			for (i = 0; i < BITSTREAM_VECTOR_SIZE; i++)
+				if (bitstream_start_code(s + offset + i))
+					bitstream_found(offset + i, &count, first_offset, last_offset);
+
+		offset += BITSTREAM_VECTOR_SIZE;
+	}
+#endif
+
+	for (; offset < size; offset++) {
+		if (d != NULL)
+			d[offset] = s[offset];
+
+		if (offset + BITSTREAM_START_CODE_SIZE <= size && bitstream_start_code(s + offset))
+			bitstream_found(offset, &count, first_offset, last_offset);
+	}
+
+	return count;
+}
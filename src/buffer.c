@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -46,7 +47,10 @@ VAStatus SunxiCedrusCreateBuffer(VADriverContextP context,
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_buffer *buffer_object = NULL;
-	void *buffer_data;
+	struct object_context *context_object;
+	void *buffer_data = NULL;
+	unsigned int capacity = 0;
+	int source_index = -1;
 	VAStatus status;
 	VABufferID id;
 
@@ -70,10 +74,42 @@ VAStatus SunxiCedrusCreateBuffer(VADriverContextP context,
 		goto error;
 	}
 
-	buffer_data = malloc(size * count);
+	/*
+	 * With zero-copy, slice data is written directly to a bitstream buffer
+	 * of the context when one is available and large enough.
+	 */
+	context_object = CONTEXT(context_id);
+	if (type == VASliceDataBufferType && context_object != NULL && context_object->zero_copy) {
+		pthread_mutex_lock(&driver_data->mutex);
+
+		source_index = context_acquire_source(context_object);
+		if (source_index >= 0 && context_object->sources_sizes[source_index] < size * count) {
+			context_release_source(context_object, source_index);
+			source_index = -1;
+		}
+
+		pthread_mutex_unlock(&driver_data->mutex);
+
+		if (source_index >= 0)
+			buffer_data = context_object->sources_data[source_index];
+	}
+
+	if (type == VAImageBufferType) {
+		buffer_data = buffer_pool_alloc_image(&driver_data->buffer_pool, size * count);
+		if (buffer_data == NULL) {
+			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+			goto error;
+		}
+
+		capacity = size * count;
+	}
+
 	if (buffer_data == NULL) {
-		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
-		goto error;
+		buffer_data = buffer_pool_alloc(&driver_data->buffer_pool, size * count, &capacity);
+		if (buffer_data == NULL) {
+			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+			goto error;
+		}
 	}
 
 	if (data != NULL)
@@ -84,6 +120,11 @@ VAStatus SunxiCedrusCreateBuffer(VADriverContextP context,
 	buffer_object->count = count;
 	buffer_object->data = buffer_data;
 	buffer_object->size = size;
+	buffer_object->capacity = capacity;
+	buffer_object->context_id = context_id;
+	buffer_object->source_index = source_index;
+	buffer_object->source_backed = source_index >= 0;
+	buffer_object->borrowed = false;
 
 	*buffer_id = id;
 
@@ -98,19 +139,61 @@ complete:
 	return status;
 }
 
+/* Creates a buffer around existing data, which is not freed with it. */
+VAStatus buffer_wrap(struct sunxi_cedrus_driver_data *driver_data,
+	VABufferType type, void *data, unsigned int size,
+	VABufferID *buffer_id)
+{
+	struct object_buffer *buffer_object;
+	VABufferID id;
+
+	id = object_heap_allocate(&driver_data->buffer_heap);
+	buffer_object = BUFFER(id);
+	if (buffer_object == NULL)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+	buffer_object->type = type;
+	buffer_object->initial_count = 1;
+	buffer_object->count = 1;
+	buffer_object->data = data;
+	buffer_object->size = size;
+	buffer_object->capacity = 0;
+	buffer_object->context_id = VA_INVALID_ID;
+	buffer_object->source_index = -1;
+	buffer_object->source_backed = false;
+	buffer_object->borrowed = true;
+
+	*buffer_id = id;
+
+	return VA_STATUS_SUCCESS;
+}
+
 VAStatus SunxiCedrusDestroyBuffer(VADriverContextP context,
 	VABufferID buffer_id)
 {
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_buffer *buffer_object;
+	struct object_context *context_object;
 
 	buffer_object = BUFFER(buffer_id);
 	if (buffer_object == NULL)
 		return VA_STATUS_ERROR_INVALID_BUFFER;
 
-	if (buffer_object->data != NULL)
-		free(buffer_object->data);
+	if (buffer_object->source_backed) {
+		/* The bitstream buffer might have been bound to a surface. */
+		context_object = CONTEXT(buffer_object->context_id);
+		if (context_object != NULL && buffer_object->source_index >= 0) {
+			pthread_mutex_lock(&driver_data->mutex);
+			context_release_source(context_object, buffer_object->source_index);
+			pthread_mutex_unlock(&driver_data->mutex);
+		}
+	} else if (buffer_object->data != NULL && !buffer_object->borrowed) {
+		if (buffer_object->type == VAImageBufferType)
+			buffer_pool_free_image(&driver_data->buffer_pool, buffer_object->data, buffer_object->capacity);
+		else
+			buffer_pool_free(&driver_data->buffer_pool, buffer_object->data, buffer_object->capacity);
+	}
 
 	object_heap_free(&driver_data->buffer_heap, (struct object_base *) buffer_object);
 
@@ -128,7 +211,10 @@ VAStatus SunxiCedrusMapBuffer(VADriverContextP context, VABufferID buffer_id,
 	if (buffer_object == NULL || buffer_object->data == NULL)
 		return VA_STATUS_ERROR_INVALID_BUFFER;
 
-	/* Our buffers are always mapped. */
+	/*
+	 * Our buffers are always mapped. With zero-copy, slice data buffers
+	 * map the bitstream buffer of the context.
+	 */
 	*data_map = buffer_object->data;
 
 	return VA_STATUS_SUCCESS;
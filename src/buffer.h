@@ -43,11 +43,23 @@ struct object_buffer {
 
 	void *data;
 	unsigned int size;
+	unsigned int capacity;
+
+	/* Bitstream buffer of the context backing the data, with zero-copy. */
+	VAContextID context_id;
+	int source_index;
+	bool source_backed;
+
+	/* Data owned by something else, such as a surface readback copy. */
+	bool borrowed;
 };
 
 VAStatus SunxiCedrusCreateBuffer(VADriverContextP context,
 	VAContextID context_id, VABufferType type, unsigned int size,
 	unsigned int count, void *data, VABufferID *buffer_id);
+VAStatus buffer_wrap(struct sunxi_cedrus_driver_data *driver_data,
+	VABufferType type, void *data, unsigned int size,
+	VABufferID *buffer_id);
 void sunxi_cedrus_destroy_buffer(struct sunxi_cedrus_driver_data *driver_data,
 	struct object_buffer *obj_buffer);
 VAStatus SunxiCedrusDestroyBuffer(VADriverContextP context,
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+
+#include "buffer_pool.h"
+
+/*
+ * Buffers are created and destroyed for every picture, so they are recycled
+ * instead of going through the heap each time: once the pool is warm, the
+ * decoding loop does not allocate memory.
+ */
+
+int buffer_pool_init(struct buffer_pool *pool)
+{
+	char *huge_value;
+	unsigned int i;
+
+	memset(pool, 0, sizeof(*pool));
+
+	pool->small_data = malloc(BUFFER_POOL_SMALL_SIZE * BUFFER_POOL_SMALL_COUNT);
+	if (pool->small_data == NULL)
+		return -1;
+
+	for (i = 0; i < BUFFER_POOL_SMALL_COUNT; i++)
+		pool->small_available[i] = BUFFER_POOL_SMALL_COUNT - i - 1;
+
+	pool->small_available_count = BUFFER_POOL_SMALL_COUNT;
+	pool->large_count = 0;
+	pool->images_count = 0;
+
+	huge_value = getenv("LIBVA_CEDRUS_HUGE_PAGES");
+	pool->images_huge = huge_value != NULL && strtol(huge_value, NULL, 10) != 0;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+
+	return 0;
+}
+
+void buffer_pool_destroy(struct buffer_pool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->large_count; i++)
+		free(pool->large_data[i]);
+
+	pool->large_count = 0;
+
+	for (i = 0; i < pool->images_count; i++)
+		free(pool->images_data[i]);
+
+	pool->images_count = 0;
+
+	if (pool->small_data != NULL) {
+		free(pool->small_data);
+		pool->small_data = NULL;
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+void *buffer_pool_alloc(struct buffer_pool *pool, unsigned int size,
+	unsigned int *capacity)
+{
+	unsigned int index;
+	unsigned int best;
+	void *data;
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if (size <= BUFFER_POOL_SMALL_SIZE && pool->small_available_count > 0) {
+		pool->small_available_count--;
+		index = pool->small_available[pool->small_available_count];
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		*capacity = BUFFER_POOL_SMALL_SIZE;
+		return (unsigned char *) pool->small_data + index * BUFFER_POOL_SMALL_SIZE;
+	}
+
+	/* Pick the smallest kept buffer that is large enough. */
+	best = pool->large_count;
+
+	for (i = 0; i < pool->large_count; i++)
+		if (pool->large_capacities[i] >= size && (best == pool->large_count || pool->large_capacities[i] < pool->large_capacities[best]))
+			best = i;
+
+	if (best < pool->large_count) {
+		data = pool->large_data[best];
+		*capacity = pool->large_capacities[best];
+
+		pool->large_count--;
+		pool->large_data[best] = pool->large_data[pool->large_count];
+		pool->large_capacities[best] = pool->large_capacities[pool->large_count];
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		return data;
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	/* Round the size up so that the buffer can be reused for larger data. */
+	size = (size + BUFFER_POOL_LARGE_ALIGN - 1) & ~(BUFFER_POOL_LARGE_ALIGN - 1);
+	if (size == 0)
+		size = BUFFER_POOL_LARGE_ALIGN;
+
+	data = malloc(size);
+	if (data == NULL)
+		return NULL;
+
+	*capacity = size;
+
+	return data;
+}
+
+void buffer_pool_free(struct buffer_pool *pool, void *data,
+	unsigned int capacity)
+{
+	unsigned char *small_start = pool->small_data;
+	unsigned char *small_end = small_start + BUFFER_POOL_SMALL_SIZE * BUFFER_POOL_SMALL_COUNT;
+	void *evicted;
+	unsigned int smallest;
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if ((unsigned char *) data >= small_start && (unsigned char *) data < small_end) {
+		pool->small_available[pool->small_available_count] = ((unsigned char *) data - small_start) / BUFFER_POOL_SMALL_SIZE;
+		pool->small_available_count++;
+
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+
+	if (capacity > BUFFER_POOL_LARGE_SIZE_MAX) {
+		pthread_mutex_unlock(&pool->mutex);
+
+		free(data);
+		return;
+	}
+
+	if (pool->large_count < BUFFER_POOL_LARGE_COUNT) {
+		pool->large_data[pool->large_count] = data;
+		pool->large_capacities[pool->large_count] = capacity;
+		pool->large_count++;
+
+		pthread_mutex_unlock(&pool->mutex);
+		return;
+	}
+
+	/* The pool is full: keep the largest buffers, which are the most useful. */
+	smallest = 0;
+
+	for (i = 1; i < pool->large_count; i++)
+		if (pool->large_capacities[i] < pool->large_capacities[smallest])
+			smallest = i;
+
+	if (pool->large_capacities[smallest] < capacity) {
+		evicted = pool->large_data[smallest];
+
+		pool->large_data[smallest] = data;
+		pool->large_capacities[smallest] = capacity;
+		data = evicted;
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	free(data);
+}
+
+/*
+ * Images are large and come and go with every picture read back, so their
+ * buffers are recycled to avoid page faults on freshly allocated memory. They
+ * are aligned for SIMD and can be backed by transparent huge pages.
+ */
+void *buffer_pool_alloc_image(struct buffer_pool *pool, unsigned int size)
+{
+	unsigned int alignment;
+	void *data;
+	unsigned int i;
+	int rc;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	for (i = 0; i < pool->images_count; i++) {
+		if (pool->images_sizes[i] != size)
+			continue;
+
+		data = pool->images_data[i];
+
+		/* Buffers are kept in the order they were released. */
+		pool->images_count--;
+		memmove(&pool->images_data[i], &pool->images_data[i + 1], (pool->images_count - i) * sizeof(*pool->images_data));
+		memmove(&pool->images_sizes[i], &pool->images_sizes[i + 1], (pool->images_count - i) * sizeof(*pool->images_sizes));
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		return data;
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	alignment = pool->images_huge ? BUFFER_POOL_IMAGES_HUGE_ALIGN : BUFFER_POOL_IMAGES_ALIGN;
+
+	rc = posix_memalign(&data, alignment, size);
+	if (rc != 0)
+		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	if (pool->images_huge)
+		madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+	return data;
+}
+
+void buffer_pool_free_image(struct buffer_pool *pool, void *data,
+	unsigned int size)
+{
+	void *evicted;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	/* The pool is full: evict the oldest buffer, likely of a stale size. */
+	if (pool->images_count == BUFFER_POOL_IMAGES_COUNT) {
+		evicted = pool->images_data[0];
+
+		memmove(&pool->images_data[0], &pool->images_data[1], (BUFFER_POOL_IMAGES_COUNT - 1) * sizeof(*pool->images_data));
+		memmove(&pool->images_sizes[0], &pool->images_sizes[1], (BUFFER_POOL_IMAGES_COUNT - 1) * sizeof(*pool->images_sizes));
+		pool->images_count--;
+	} else {
+		evicted = NULL;
+	}
+
+	pool->images_data[pool->images_count] = data;
+	pool->images_sizes[pool->images_count] = size;
+	pool->images_count++;
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (evicted != NULL)
+		free(evicted);
+}
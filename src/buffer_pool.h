@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Small buffers (parameters, matrices) come from fixed-size slab entries. */
+#define BUFFER_POOL_SMALL_SIZE					1024
+#define BUFFER_POOL_SMALL_COUNT					64
+
+/* Large buffers (slice data) are kept around for reuse by capacity. */
+#define BUFFER_POOL_LARGE_COUNT					16
+#define BUFFER_POOL_LARGE_SIZE_MAX				(1024 * 1024)
+#define BUFFER_POOL_LARGE_ALIGN					4096
+
+/* Image buffers are kept around for reuse by exact size, so by resolution. */
+#define BUFFER_POOL_IMAGES_COUNT				8
+#define BUFFER_POOL_IMAGES_ALIGN				64
+#define BUFFER_POOL_IMAGES_HUGE_ALIGN				(2 * 1024 * 1024)
+
+struct buffer_pool {
+	pthread_mutex_t mutex;
+
+	void *small_data;
+	unsigned int small_available[BUFFER_POOL_SMALL_COUNT];
+	unsigned int small_available_count;
+
+	void *large_data[BUFFER_POOL_LARGE_COUNT];
+	unsigned int large_capacities[BUFFER_POOL_LARGE_COUNT];
+	unsigned int large_count;
+
+	void *images_data[BUFFER_POOL_IMAGES_COUNT];
+	unsigned int images_sizes[BUFFER_POOL_IMAGES_COUNT];
+	unsigned int images_count;
+	bool images_huge;
+};
+
+int buffer_pool_init(struct buffer_pool *pool);
+void buffer_pool_destroy(struct buffer_pool *pool);
+void *buffer_pool_alloc(struct buffer_pool *pool, unsigned int size,
+	unsigned int *capacity);
+void buffer_pool_free(struct buffer_pool *pool, void *data,
+	unsigned int capacity);
+void *buffer_pool_alloc_image(struct buffer_pool *pool, unsigned int size);
+void buffer_pool_free_image(struct buffer_pool *pool, void *data,
+	unsigned int size);
+
+#endif
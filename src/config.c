@@ -28,6 +28,7 @@
 
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 
@@ -188,17 +189,66 @@ VAStatus SunxiCedrusGetConfigAttributes(VADriverContextP context,
 VAStatus SunxiCedrusQueryDisplayAttributes(VADriverContextP context,
 	VADisplayAttribute *attributes, int *attributes_count)
 {
-	return VA_STATUS_ERROR_UNIMPLEMENTED;
+	struct sunxi_cedrus_driver_data *driver_data =
+		(struct sunxi_cedrus_driver_data *) context->pDriverData;
+
+	/* Rotation applies to the images read back from surfaces. */
+	attributes[0].type = VADisplayAttribRotation;
+	attributes[0].min_value = VA_ROTATION_NONE;
+	attributes[0].max_value = VA_ROTATION_270;
+	attributes[0].value = driver_data->rotation;
+	attributes[0].flags = VA_DISPLAY_ATTRIB_GETTABLE | VA_DISPLAY_ATTRIB_SETTABLE;
+
+	*attributes_count = 1;
+
+	return VA_STATUS_SUCCESS;
 }
 
 VAStatus SunxiCedrusGetDisplayAttributes(VADriverContextP context,
 	VADisplayAttribute *attributes, int attributes_count)
 {
-	return VA_STATUS_ERROR_UNIMPLEMENTED;
+	struct sunxi_cedrus_driver_data *driver_data =
+		(struct sunxi_cedrus_driver_data *) context->pDriverData;
+	unsigned int i;
+
+	for (i = 0; i < attributes_count; i++) {
+		switch (attributes[i].type) {
+			case VADisplayAttribRotation:
+				attributes[i].min_value = VA_ROTATION_NONE;
+				attributes[i].max_value = VA_ROTATION_270;
+				attributes[i].value = driver_data->rotation;
+				attributes[i].flags = VA_DISPLAY_ATTRIB_GETTABLE | VA_DISPLAY_ATTRIB_SETTABLE;
+				break;
+			default:
+				attributes[i].flags = VA_DISPLAY_ATTRIB_NOT_SUPPORTED;
+				break;
+		}
+	}
+
+	return VA_STATUS_SUCCESS;
 }
 
 VAStatus SunxiCedrusSetDisplayAttributes(VADriverContextP context,
 	VADisplayAttribute *attributes, int attributes_count)
 {
-	return VA_STATUS_ERROR_UNIMPLEMENTED;
+	struct sunxi_cedrus_driver_data *driver_data =
+		(struct sunxi_cedrus_driver_data *) context->pDriverData;
+	unsigned int i;
+
+	for (i = 0; i < attributes_count; i++) {
+		switch (attributes[i].type) {
+			case VADisplayAttribRotation:
+				if (attributes[i].value < VA_ROTATION_NONE || attributes[i].value > VA_ROTATION_270)
+					return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+				pthread_mutex_lock(&driver_data->mutex);
+				driver_data->rotation = attributes[i].value;
+				pthread_mutex_unlock(&driver_data->mutex);
+				break;
+			default:
+				return VA_STATUS_ERROR_ATTR_NOT_SUPPORTED;
+		}
+	}
+
+	return VA_STATUS_SUCCESS;
 }
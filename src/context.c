@@ -30,15 +30,22 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <assert.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
 #include <linux/videodev2.h>
 
+#include "picture.h"
+#include "mpeg2.h"
+
 #include "v4l2.h"
+#include "media.h"
+#include "reactor.h"
 #include "utils.h"
 
 VAStatus SunxiCedrusCreateContext(VADriverContextP context,
@@ -53,11 +60,28 @@ VAStatus SunxiCedrusCreateContext(VADriverContextP context,
 	struct object_context *context_object = NULL;
 	unsigned int length;
 	unsigned int offset;
-	void *source_data = MAP_FAILED;
+	void **sources_data = NULL;
+	unsigned int *sources_sizes = NULL;
+	unsigned int *sources_available = NULL;
+	unsigned int sources_count = 0;
 	VASurfaceID *ids = NULL;
+	VASurfaceID *queued_ids = NULL;
+	int *requests_fds = NULL;
+	unsigned int requests_count = 0;
+	char *requests_count_value;
+	char *zero_copy_value;
+	bool zero_copy;
+	int *slices_requests_fds = NULL;
+	unsigned int *slices_sources = NULL;
+	VASurfaceID *slices_surfaces_ids = NULL;
+	char *slice_submission_value;
+	bool slice_submission;
+	unsigned int capabilities;
+	int request_fd;
 	VAContextID id;
 	VAStatus status;
 	unsigned int pixelformat;
+	unsigned int source_size;
 	unsigned int i;
 	int rc;
 
@@ -78,55 +102,143 @@ VAStatus SunxiCedrusCreateContext(VADriverContextP context,
 		case VAProfileMPEG2Simple:
 		case VAProfileMPEG2Main:
 			pixelformat = V4L2_PIX_FMT_MPEG2_FRAME;
+			source_size = mpeg2_source_size(config_object->profile, picture_width, picture_height);
 			break;
 
 		default:
-			return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+			status = VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
+			goto error;
 	}
 
-	rc = v4l2_set_format(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, pixelformat, picture_width, picture_height);
+	rc = v4l2_set_format(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, pixelformat, picture_width, picture_height, source_size);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
 	}
 
-	rc = v4l2_create_buffers(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, surfaces_count);
-	if (rc < 0) {
+	ids = malloc(surfaces_count * sizeof(VASurfaceID));
+	if (ids == NULL) {
 		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
 		goto error;
 	}
 
-	ids = malloc(surfaces_count * sizeof(VASurfaceID));
-	if (ids == NULL) {
+	queued_ids = malloc(surfaces_count * sizeof(VASurfaceID));
+	if (queued_ids == NULL) {
 		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
 		goto error;
 	}
 
-	for (i = 0; i < surfaces_count; i++) {
-		surface_object = SURFACE(surfaces_ids[i]);
-		if (surface_object == NULL) {
-			status = VA_STATUS_ERROR_INVALID_SURFACE;
+	/*
+	 * The number of requests bounds the number of pictures in flight, so
+	 * there is no need for more than one per surface.
+	 */
+	requests_count_value = getenv("LIBVA_CEDRUS_REQUESTS_COUNT");
+	if (requests_count_value != NULL)
+		requests_count = strtoul(requests_count_value, NULL, 10);
+
+	if (requests_count == 0)
+		requests_count = CONTEXT_REQUESTS_COUNT_DEFAULT;
+
+	if (requests_count > surfaces_count)
+		requests_count = surfaces_count;
+
+	requests_fds = malloc(requests_count * sizeof(int));
+	if (requests_fds == NULL) {
+		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		goto error;
+	}
+
+	for (i = 0; i < requests_count; i++)
+		requests_fds[i] = -1;
+
+	for (i = 0; i < requests_count; i++) {
+		request_fd = media_request_alloc(driver_data->media_fd);
+		if (request_fd < 0) {
+			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
 			goto error;
 		}
 
-		if (surface_object->destination_index != i)
-			sunxi_cedrus_log("Mismatch between source index %d and destination index %d for surface %d\n", i, surface_object->destination_index, surfaces_ids[i]);
+		requests_fds[i] = request_fd;
+	}
+
+	/*
+	 * Bitstream buffers are only needed for the pictures in flight and the
+	 * one being rendered, so they are shared between surfaces. Slice data
+	 * buffers can also be backed by them when zero-copy is enabled.
+	 */
+	zero_copy_value = getenv("LIBVA_CEDRUS_ZERO_COPY");
+	zero_copy = zero_copy_value != NULL && strtoul(zero_copy_value, NULL, 10) != 0;
+
+	sources_count = requests_count + 1;
+	if (zero_copy)
+		sources_count += CONTEXT_SLICE_SOURCES_COUNT;
+
+	sources_data = malloc(sources_count * sizeof(void *));
+	sources_sizes = malloc(sources_count * sizeof(unsigned int));
+	sources_available = malloc(sources_count * sizeof(unsigned int));
+	if (sources_data == NULL || sources_sizes == NULL || sources_available == NULL) {
+		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		goto error;
+	}
+
+	for (i = 0; i < sources_count; i++)
+		sources_data[i] = MAP_FAILED;
 
+	rc = v4l2_create_buffers(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, sources_count, 0, NULL);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		goto error;
+	}
+
+	for (i = 0; i < sources_count; i++) {
 		rc = v4l2_request_buffer(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, i, &length, &offset);
 		if (rc < 0) {
 			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
 			goto error;
 		}
 
-		source_data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, driver_data->video_fd, offset);
-		if (source_data == MAP_FAILED) {
+		sources_data[i] = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, driver_data->video_fd, offset);
+		if (sources_data[i] == MAP_FAILED) {
 			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
 			goto error;
 		}
 
-		surface_object->source_index = i;
-		surface_object->source_data = source_data;
-		surface_object->source_size = length;
+		sources_sizes[i] = length;
+		sources_available[i] = i;
+	}
+
+	/*
+	 * Submitting each slice on its own lets the decoding start before the
+	 * whole picture was received, which requires the driver to hold the
+	 * capture buffer until the last slice.
+	 */
+	slice_submission_value = getenv("LIBVA_CEDRUS_SLICE_SUBMISSION");
+	slice_submission = slice_submission_value != NULL && strtoul(slice_submission_value, NULL, 10) != 0;
+
+	if (slice_submission) {
+		rc = v4l2_query_buffers_capabilities(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &capabilities);
+		if (rc < 0 || !(capabilities & V4L2_BUF_CAP_SUPPORTS_M2M_HOLD_CAPTURE_BUF)) {
+			sunxi_cedrus_log("Slice submission is not supported, submitting pictures\n");
+			slice_submission = false;
+		}
+	}
+
+	if (slice_submission) {
+		slices_requests_fds = malloc(requests_count * sizeof(int));
+		slices_sources = malloc(requests_count * sizeof(unsigned int));
+		slices_surfaces_ids = malloc(requests_count * sizeof(VASurfaceID));
+		if (slices_requests_fds == NULL || slices_sources == NULL || slices_surfaces_ids == NULL) {
+			status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+			goto error;
+		}
+	}
+
+	for (i = 0; i < surfaces_count; i++) {
+		surface_object = SURFACE(surfaces_ids[i]);
+		if (surface_object == NULL) {
+			status = VA_STATUS_ERROR_INVALID_SURFACE;
+			goto error;
+		}
 
 		ids[i] = surfaces_ids[i];
 	}
@@ -147,6 +259,31 @@ VAStatus SunxiCedrusCreateContext(VADriverContextP context,
 	context_object->render_surface_id = VA_INVALID_ID;
 	context_object->surfaces_ids = ids;
 	context_object->surfaces_count = surfaces_count;
+	context_object->queued_ids = queued_ids;
+	context_object->queued_first = 0;
+	context_object->queued_count = 0;
+	context_object->requests_fds = requests_fds;
+	context_object->requests_count = requests_count;
+	context_object->requests_available_count = requests_count;
+	context_object->sources_data = sources_data;
+	context_object->sources_sizes = sources_sizes;
+	context_object->sources_count = sources_count;
+	context_object->sources_available = sources_available;
+	context_object->sources_available_count = sources_count;
+	context_object->zero_copy = zero_copy;
+	context_object->slices_requests_fds = slices_requests_fds;
+	context_object->slices_sources = slices_sources;
+	context_object->slices_surfaces_ids = slices_surfaces_ids;
+	context_object->slices_first = 0;
+	context_object->slices_count = 0;
+	context_object->slice_submission = slice_submission;
+	context_object->sequence = 0;
+	context_object->decode_times_index = 0;
+	context_object->decode_times_count = 0;
+	context_object->completed_timestamp = 0;
+	context_object->timeout = CONTEXT_TIMEOUT_DEFAULT;
+	memset(&context_object->mpeg2_quantization, 0, sizeof(context_object->mpeg2_quantization));
+	context_object->mpeg2_quantization_uploaded = false;
 	context_object->picture_width = picture_width;
 	context_object->picture_height = picture_height;
 	context_object->flags = flags;
@@ -157,12 +294,43 @@ VAStatus SunxiCedrusCreateContext(VADriverContextP context,
 	goto complete;
 
 error:
-	if (source_data != MAP_FAILED)
-		munmap(source_data, length);
+	if (sources_data != NULL) {
+		for (i = 0; i < sources_count; i++)
+			if (sources_data[i] != MAP_FAILED)
+				munmap(sources_data[i], sources_sizes[i]);
+
+		free(sources_data);
+	}
+
+	if (sources_sizes != NULL)
+		free(sources_sizes);
+
+	if (sources_available != NULL)
+		free(sources_available);
+
+	if (slices_requests_fds != NULL)
+		free(slices_requests_fds);
+
+	if (slices_sources != NULL)
+		free(slices_sources);
+
+	if (slices_surfaces_ids != NULL)
+		free(slices_surfaces_ids);
 
 	if (ids != NULL)
 		free(ids);
 
+	if (queued_ids != NULL)
+		free(queued_ids);
+
+	if (requests_fds != NULL) {
+		for (i = 0; i < requests_count; i++)
+			if (requests_fds[i] >= 0)
+				close(requests_fds[i]);
+
+		free(requests_fds);
+	}
+
 	if (context_object != NULL)
 		object_heap_free(&driver_data->context_heap, (struct object_base *) context_object);
 
@@ -170,27 +338,572 @@ complete:
 	return status;
 }
 
+/*
+ * Completes the pictures in flight and stops both queues, so that the hardware
+ * is done with the requests and buffers of the context before they go away.
+ * Its surfaces are left without a bitstream buffer. This must be called with
+ * the driver mutex held.
+ */
+static int context_drain(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object)
+{
+	struct object_surface *surface_object;
+	object_heap_iterator iterator;
+	VASurfaceID surface_id;
+	int rc = 0;
+
+	while (context_object->queued_count > 0)
+		if (surface_sync_oldest(driver_data, context_object) != VA_STATUS_SUCCESS)
+			break;
+
+	/* Requests that did not complete are cancelled by stopping the queues. */
+	while (context_object->queued_count > 0) {
+		surface_id = context_dequeue_surface(context_object);
+
+		surface_object = SURFACE(surface_id);
+		if (surface_object != NULL && surface_object->request_fd >= 0) {
+			reactor_unwatch_request(driver_data, surface_object->request_fd);
+			surface_object->request_fd = -1;
+		}
+	}
+
+	if (v4l2_set_stream(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, false) < 0)
+		rc = -1;
+
+	if (v4l2_set_stream(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, false) < 0)
+		rc = -1;
+
+	context_drop_slices(driver_data, context_object);
+
+	surface_object = (struct object_surface *) object_heap_first(&driver_data->surface_heap, &iterator);
+	while (surface_object != NULL) {
+		if (surface_object->context_id == context_object->base.id) {
+			surface_object->source_index = 0;
+			surface_object->source_data = NULL;
+			surface_object->source_size = 0;
+			surface_object->destination_queued = false;
+			surface_object->context_id = VA_INVALID_ID;
+
+			if (surface_object->status == VASurfaceRendering)
+				surface_object->status = VASurfaceReady;
+		}
+
+		surface_object = (struct object_surface *) object_heap_next(&driver_data->surface_heap, &iterator);
+	}
+
+	context_object->render_surface_id = VA_INVALID_ID;
+
+	return rc;
+}
+
 VAStatus SunxiCedrusDestroyContext(VADriverContextP context,
 	VAContextID context_id)
 {
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_context *context_object;
+	VAStatus status;
+	unsigned int i;
 	int rc;
 
 	context_object = CONTEXT(context_id);
 	if (context_object == NULL)
 		return VA_STATUS_ERROR_INVALID_CONTEXT;
 
+	pthread_mutex_lock(&driver_data->mutex);
+
+	rc = context_drain(driver_data, context_object);
+	status = rc < 0 ? VA_STATUS_ERROR_OPERATION_FAILED : VA_STATUS_SUCCESS;
+
+	if (context_object->requests_fds != NULL) {
+		for (i = 0; i < context_object->requests_count; i++)
+			if (context_object->requests_fds[i] >= 0)
+				close(context_object->requests_fds[i]);
+
+		free(context_object->requests_fds);
+	}
+
+	if (context_object->sources_data != NULL) {
+		for (i = 0; i < context_object->sources_count; i++)
+			if (context_object->sources_data[i] != MAP_FAILED)
+				munmap(context_object->sources_data[i], context_object->sources_sizes[i]);
+
+		free(context_object->sources_data);
+	}
+
+	if (context_object->sources_sizes != NULL)
+		free(context_object->sources_sizes);
+
+	if (context_object->sources_available != NULL)
+		free(context_object->sources_available);
+
+	if (context_object->slices_requests_fds != NULL)
+		free(context_object->slices_requests_fds);
+
+	if (context_object->slices_sources != NULL)
+		free(context_object->slices_sources);
+
+	if (context_object->slices_surfaces_ids != NULL)
+		free(context_object->slices_surfaces_ids);
+
+	if (context_object->surfaces_ids != NULL)
+		free(context_object->surfaces_ids);
+
+	if (context_object->queued_ids != NULL)
+		free(context_object->queued_ids);
+
 	object_heap_free(&driver_data->context_heap, (struct object_base *) context_object);
 
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
+}
+
+int context_queue_surface(struct object_context *context_object,
+	VASurfaceID surface_id)
+{
+	unsigned int index;
+
+	if (context_object->queued_count >= context_object->surfaces_count)
+		return -1;
+
+	index = (context_object->queued_first + context_object->queued_count) % context_object->surfaces_count;
+	context_object->queued_ids[index] = surface_id;
+	context_object->queued_count++;
+
+	return 0;
+}
+
+VASurfaceID context_dequeue_surface(struct object_context *context_object)
+{
+	VASurfaceID surface_id;
+
+	if (context_object->queued_count == 0)
+		return VA_INVALID_ID;
+
+	surface_id = context_object->queued_ids[context_object->queued_first];
+	context_object->queued_first = (context_object->queued_first + 1) % context_object->surfaces_count;
+	context_object->queued_count--;
+
+	return surface_id;
+}
+
+bool context_surface_queued(struct object_context *context_object,
+	VASurfaceID surface_id)
+{
+	return context_surface_position(context_object, surface_id) >= 0;
+}
+
+int context_surface_position(struct object_context *context_object,
+	VASurfaceID surface_id)
+{
+	unsigned int index;
+	unsigned int i;
+
+	for (i = 0; i < context_object->queued_count; i++) {
+		index = (context_object->queued_first + i) % context_object->surfaces_count;
+		if (context_object->queued_ids[index] == surface_id)
+			return i;
+	}
+
+	return -1;
+}
+
+/* Removes a surface from the queue, keeping the others in submission order. */
+void context_remove_surface(struct object_context *context_object,
+	unsigned int position)
+{
+	unsigned int index, next;
+	unsigned int i;
+
+	for (i = position; i + 1 < context_object->queued_count; i++) {
+		index = (context_object->queued_first + i) % context_object->surfaces_count;
+		next = (context_object->queued_first + i + 1) % context_object->surfaces_count;
+		context_object->queued_ids[index] = context_object->queued_ids[next];
+	}
+
+	context_object->queued_count--;
+}
+
+int context_acquire_request(struct object_context *context_object)
+{
+	if (context_object->requests_available_count == 0)
+		return -1;
+
+	context_object->requests_available_count--;
+
+	return context_object->requests_fds[context_object->requests_available_count];
+}
+
+void context_release_request(struct object_context *context_object,
+	int request_fd)
+{
+	unsigned int index;
+	unsigned int i;
+
+	/* Keep the available requests at the beginning of the pool. */
+	for (i = context_object->requests_available_count; i < context_object->requests_count; i++) {
+		if (context_object->requests_fds[i] != request_fd)
+			continue;
+
+		index = context_object->requests_available_count;
+		context_object->requests_fds[i] = context_object->requests_fds[index];
+		context_object->requests_fds[index] = request_fd;
+		context_object->requests_available_count++;
+		break;
+	}
+}
+
+int context_renew_request(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object, int request_fd)
+{
+	int renewed_fd;
+	unsigned int i;
+
+	/*
+	 * A request that failed is left in an unknown state, so it is replaced
+	 * by a fresh one to keep the pool size constant.
+	 */
+	renewed_fd = media_request_alloc(driver_data->media_fd);
+
+	for (i = context_object->requests_available_count; i < context_object->requests_count; i++) {
+		if (context_object->requests_fds[i] != request_fd)
+			continue;
+
+		close(request_fd);
+		context_object->requests_fds[i] = renewed_fd;
+
+		if (renewed_fd >= 0)
+			context_release_request(context_object, renewed_fd);
+
+		return renewed_fd < 0 ? -1 : 0;
+	}
+
+	if (renewed_fd >= 0)
+		close(renewed_fd);
+
+	return -1;
+}
+
+int context_acquire_source(struct object_context *context_object)
+{
+	if (context_object->sources_available_count == 0)
+		return -1;
+
+	context_object->sources_available_count--;
+
+	return context_object->sources_available[context_object->sources_available_count];
+}
+
+void context_release_source(struct object_context *context_object,
+	unsigned int index)
+{
+	context_object->sources_available[context_object->sources_available_count] = index;
+	context_object->sources_available_count++;
+}
+
+static int decode_time_compare(const void *a, const void *b)
+{
+	unsigned int time_a = *((const unsigned int *) a);
+	unsigned int time_b = *((const unsigned int *) b);
+
+	return (time_a > time_b) - (time_a < time_b);
+}
+
+/*
+ * Creates a bitstream buffer of at least the given size. The buffers that
+ * became too small can't be freed while streaming, so they are simply no
+ * longer handed out. This must be called with the driver mutex held.
+ */
+int context_grow_source(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object, unsigned int size)
+{
+	void **sources_data;
+	unsigned int *sources_sizes;
+	unsigned int *sources_available;
+	unsigned int sources_count;
+	unsigned int length;
+	unsigned int offset;
+	unsigned int index;
+	void *data;
+	unsigned int i;
+	int rc;
+
+	if (size > CONTEXT_SOURCE_SIZE_MAX)
+		return -1;
+
+	rc = v4l2_create_buffers(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, 1, size, &index);
+	if (rc < 0)
+		return -1;
+
+	rc = v4l2_request_buffer(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, index, &length, &offset);
+	if (rc < 0)
+		return -1;
+
+	if (length < size)
+		return -1;
+
+	data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, driver_data->video_fd, offset);
+	if (data == MAP_FAILED)
+		return -1;
+
+	if (index >= context_object->sources_count) {
+		sources_count = index + 1;
+
+		sources_data = realloc(context_object->sources_data, sources_count * sizeof(void *));
+		if (sources_data != NULL)
+			context_object->sources_data = sources_data;
+
+		sources_sizes = realloc(context_object->sources_sizes, sources_count * sizeof(unsigned int));
+		if (sources_sizes != NULL)
+			context_object->sources_sizes = sources_sizes;
+
+		sources_available = realloc(context_object->sources_available, sources_count * sizeof(unsigned int));
+		if (sources_available != NULL)
+			context_object->sources_available = sources_available;
+
+		if (sources_data == NULL || sources_sizes == NULL || sources_available == NULL) {
+			munmap(data, length);
+			return -1;
+		}
+
+		for (i = context_object->sources_count; i < sources_count; i++) {
+			context_object->sources_data[i] = MAP_FAILED;
+			context_object->sources_sizes[i] = 0;
+		}
+
+		context_object->sources_count = sources_count;
+	}
+
+	context_object->sources_data[index] = data;
+	context_object->sources_sizes[index] = length;
+
+	return index;
+}
+
+int context_hold_slice(struct object_context *context_object,
+	VASurfaceID surface_id, int request_fd, unsigned int source_index)
+{
+	unsigned int index;
+
+	if (context_object->slices_count >= context_object->requests_count)
+		return -1;
+
+	index = (context_object->slices_first + context_object->slices_count) % context_object->requests_count;
+	context_object->slices_requests_fds[index] = request_fd;
+	context_object->slices_sources[index] = source_index;
+	context_object->slices_surfaces_ids[index] = surface_id;
+	context_object->slices_count++;
+
+	return 0;
+}
+
+/*
+ * Completes the oldest slice submitted ahead of its picture, giving its request
+ * and bitstream buffer back to the context. This must be called with the
+ * driver mutex held.
+ */
+int context_complete_slice(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object)
+{
+	unsigned int index = context_object->slices_first;
+	int request_fd;
+	int rc;
+
+	if (context_object->slices_count == 0)
+		return -1;
+
+	request_fd = context_object->slices_requests_fds[index];
+
+	context_object->slices_first = (context_object->slices_first + 1) % context_object->requests_count;
+	context_object->slices_count--;
+
+	rc = media_request_wait_completion(request_fd, context_object->timeout);
+	if (rc < 0)
+		goto error;
+
+	rc = media_request_reinit(request_fd);
+	if (rc < 0)
+		goto error;
+
+	rc = v4l2_dequeue_buffer(driver_data->video_fd, request_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, context_object->slices_sources[index]);
+	if (rc < 0)
+		goto error;
+
+	context_release_request(context_object, request_fd);
+	context_release_source(context_object, context_object->slices_sources[index]);
+
+	return 0;
+
+error:
+	context_renew_request(driver_data, context_object, request_fd);
+	context_release_source(context_object, context_object->slices_sources[index]);
+
+	return -1;
+}
+
+/*
+ * Gives back the requests and bitstream buffers of the slices submitted ahead
+ * of their picture, once the queues were stopped.
+ */
+void context_drop_slices(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object)
+{
+	unsigned int index;
+	int request_fd;
+	int rc;
+
+	while (context_object->slices_count > 0) {
+		index = context_object->slices_first;
+		request_fd = context_object->slices_requests_fds[index];
+
+		rc = media_request_reinit(request_fd);
+		if (rc < 0)
+			context_renew_request(driver_data, context_object, request_fd);
+		else
+			context_release_request(context_object, request_fd);
+
+		context_release_source(context_object, context_object->slices_sources[index]);
+
+		context_object->slices_first = (context_object->slices_first + 1) % context_object->requests_count;
+		context_object->slices_count--;
+	}
+}
+
+void context_record_decode_time(struct object_context *context_object,
+	uint64_t queued_timestamp)
+{
+	unsigned int decode_times[CONTEXT_DECODE_TIMES_COUNT];
+	unsigned int count;
+	uint64_t timestamp;
+	uint64_t start;
+	uint64_t timeout;
+
+	/*
+	 * The decoding of a picture only starts once the previous one is
+	 * completed, so the time spent waiting for it is not accounted.
+	 */
+	timestamp = sunxi_cedrus_timestamp();
+	start = queued_timestamp > context_object->completed_timestamp ? queued_timestamp : context_object->completed_timestamp;
+	context_object->completed_timestamp = timestamp;
+
+	context_object->decode_times[context_object->decode_times_index] = timestamp - start;
+	context_object->decode_times_index = (context_object->decode_times_index + 1) % CONTEXT_DECODE_TIMES_COUNT;
+
+	if (context_object->decode_times_count < CONTEXT_DECODE_TIMES_COUNT)
+		context_object->decode_times_count++;
+
+	count = context_object->decode_times_count;
+	if (count < CONTEXT_DECODE_TIMES_MIN || (context_object->decode_times_index % CONTEXT_DECODE_TIMES_MIN) != 0)
+		return;
+
+	/* Derive the timeout from the 99th percentile of decoding times. */
+	memcpy(decode_times, context_object->decode_times, count * sizeof(*decode_times));
+	qsort(decode_times, count, sizeof(*decode_times), decode_time_compare);
+
+	timeout = (uint64_t) decode_times[(count * 99) / 100] * CONTEXT_TIMEOUT_FACTOR;
+	if (timeout < CONTEXT_TIMEOUT_MIN)
+		timeout = CONTEXT_TIMEOUT_MIN;
+	else if (timeout > CONTEXT_TIMEOUT_MAX)
+		timeout = CONTEXT_TIMEOUT_MAX;
+
+	context_object->timeout = timeout;
+}
+
+/*
+ * Recovers from a stuck request by restarting both queues, which returns all
+ * the buffers in flight. The oldest request, that is the stuck one, is dropped
+ * while the ones queued after it are submitted again. This must be called with
+ * the driver mutex held.
+ */
+int context_recover(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object)
+{
+	struct object_surface *surface_object;
+	unsigned int queued_first = context_object->queued_first;
+	unsigned int queued_count = context_object->queued_count;
+	unsigned int index;
+	VAStatus status;
+	unsigned int i;
+	int rc;
+
+	sunxi_cedrus_log("Restarting streams to recover from a stuck request\n");
+
 	rc = v4l2_set_stream(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, false);
 	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+		return -1;
 
 	rc = v4l2_set_stream(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, false);
 	if (rc < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+		return -1;
+
+	for (i = 0; i < queued_count; i++) {
+		index = (queued_first + i) % context_object->surfaces_count;
+
+		surface_object = SURFACE(context_object->queued_ids[index]);
+		if (surface_object == NULL || surface_object->request_fd < 0)
+			continue;
+
+		reactor_unwatch_request(driver_data, surface_object->request_fd);
+
+		rc = media_request_reinit(surface_object->request_fd);
+		if (rc < 0)
+			context_renew_request(driver_data, context_object, surface_object->request_fd);
+		else
+			context_release_request(context_object, surface_object->request_fd);
+
+		surface_object->request_fd = -1;
+		surface_object->destination_queued = false;
+	}
+
+	context_drop_slices(driver_data, context_object);
+
+	/* The picture being rendered lost the slices it already submitted. */
+	surface_object = SURFACE(context_object->render_surface_id);
+	if (surface_object != NULL)
+		surface_object->destination_queued = false;
+
+	rc = v4l2_set_stream(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, true);
+	if (rc < 0)
+		return -1;
+
+	rc = v4l2_set_stream(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, true);
+	if (rc < 0)
+		return -1;
+
+	context_object->queued_count = 0;
+	context_object->completed_timestamp = 0;
+
+	/* Controls carried by the dropped requests are lost. */
+	context_object->mpeg2_quantization_uploaded = false;
+
+	/*
+	 * Surfaces are queued again in the same order, so each entry is read
+	 * before being overwritten.
+	 */
+	for (i = 0; i < queued_count; i++) {
+		index = (queued_first + i) % context_object->surfaces_count;
+
+		surface_object = SURFACE(context_object->queued_ids[index]);
+		if (surface_object == NULL)
+			continue;
+
+		/*
+		 * With slice submission, only the last slices of the pictures
+		 * are still around so none of them can be submitted again.
+		 */
+		if (i == 0 || context_object->slice_submission) {
+			surface_release_source(context_object, surface_object);
+			surface_object->status = VASurfaceReady;
+			continue;
+		}
+
+		status = picture_submit(driver_data, context_object, surface_object);
+		if (status != VA_STATUS_SUCCESS) {
+			surface_release_source(context_object, surface_object);
+			surface_object->status = VASurfaceReady;
+		}
+	}
 
-	return VA_STATUS_SUCCESS;
+	return 0;
 }
@@ -26,13 +26,33 @@
 #ifndef _CONTEXT_H_
 #define _CONTEXT_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <va/va_backend.h>
 
+#include <linux/videodev2.h>
+
 #include "object_heap.h"
 
+struct sunxi_cedrus_driver_data;
+
 #define CONTEXT(id) ((struct object_context *) object_heap_lookup(&driver_data->context_heap, id))
 #define CONTEXT_ID_OFFSET		0x02000000
 
+#define CONTEXT_REQUESTS_COUNT_DEFAULT	4
+#define CONTEXT_SLICE_SOURCES_COUNT	2
+#define CONTEXT_SOURCE_SIZE_MAX		(16 * 1024 * 1024)
+
+/* Request timeouts, in microseconds. */
+#define CONTEXT_TIMEOUT_DEFAULT		300000
+#define CONTEXT_TIMEOUT_MIN		20000
+#define CONTEXT_TIMEOUT_MAX		2000000
+#define CONTEXT_TIMEOUT_FACTOR		4
+
+#define CONTEXT_DECODE_TIMES_COUNT	128
+#define CONTEXT_DECODE_TIMES_MIN	16
+
 struct object_context {
 	struct object_base base;
 
@@ -41,6 +61,53 @@ struct object_context {
 	VASurfaceID *surfaces_ids;
 	int surfaces_count;
 
+	/* Surfaces with a queued request, in submission order. */
+	VASurfaceID *queued_ids;
+	unsigned int queued_first;
+	unsigned int queued_count;
+
+	/* Pre-allocated media requests, the first ones being available. */
+	int *requests_fds;
+	unsigned int requests_count;
+	unsigned int requests_available_count;
+
+	/* Bitstream buffers, the available ones being listed by index. */
+	void **sources_data;
+	unsigned int *sources_sizes;
+	unsigned int sources_count;
+	unsigned int *sources_available;
+	unsigned int sources_available_count;
+	bool zero_copy;
+
+	/*
+	 * Slices submitted ahead of the end of their picture, with the capture
+	 * buffer held by the driver, listed in submission order.
+	 */
+	int *slices_requests_fds;
+	unsigned int *slices_sources;
+	VASurfaceID *slices_surfaces_ids;
+	unsigned int slices_first;
+	unsigned int slices_count;
+	bool slice_submission;
+	uint64_t sequence;
+
+	/*
+	 * Decoding times of the last pictures, in microseconds, from which
+	 * the request timeout is derived.
+	 */
+	unsigned int decode_times[CONTEXT_DECODE_TIMES_COUNT];
+	unsigned int decode_times_index;
+	unsigned int decode_times_count;
+	uint64_t completed_timestamp;
+	unsigned int timeout;
+
+	/*
+	 * Quantisation matrices last uploaded, that the following requests
+	 * inherit unless they carry new ones.
+	 */
+	struct v4l2_ctrl_mpeg2_quantization mpeg2_quantization;
+	bool mpeg2_quantization_uploaded;
+
 	int picture_width;
 	int picture_height;
 	int flags;
@@ -52,5 +119,34 @@ VAStatus SunxiCedrusCreateContext(VADriverContextP context,
 	VAContextID *context_id);
 VAStatus SunxiCedrusDestroyContext(VADriverContextP context,
 	VAContextID context_id);
+int context_queue_surface(struct object_context *context_object,
+	VASurfaceID surface_id);
+VASurfaceID context_dequeue_surface(struct object_context *context_object);
+bool context_surface_queued(struct object_context *context_object,
+	VASurfaceID surface_id);
+int context_surface_position(struct object_context *context_object,
+	VASurfaceID surface_id);
+void context_remove_surface(struct object_context *context_object,
+	unsigned int position);
+int context_acquire_request(struct object_context *context_object);
+void context_release_request(struct object_context *context_object,
+	int request_fd);
+int context_acquire_source(struct object_context *context_object);
+void context_release_source(struct object_context *context_object,
+	unsigned int index);
+int context_renew_request(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object, int request_fd);
+int context_grow_source(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object, unsigned int size);
+int context_hold_slice(struct object_context *context_object,
+	VASurfaceID surface_id, int request_fd, unsigned int source_index);
+int context_complete_slice(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object);
+void context_drop_slices(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object);
+void context_record_decode_time(struct object_context *context_object,
+	uint64_t queued_timestamp);
+int context_recover(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object);
 
 #endif
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "detile.h"
+#include "tiled_yuv.h"
+
+/*
+ * Planes are split in bands of whole tile rows, which are detiled by a few
+ * persistent worker threads and by the calling thread itself. Bands are
+ * independent from each other since each covers its own source tiles and its
+ * own part of the destination.
+ */
+
+/*
+ * Returns where the band starts in the destination. Bands start on tile rows,
+ * which are whole boxes when scaling, and rotation moves their source lines
+ * to the last lines or to columns.
+ */
+static unsigned int detile_band_offset(struct detile_plane *plane,
+	struct detile_band *band)
+{
+	unsigned int step = plane->interleaved && plane->destination2 == NULL ? 2 : 1;
+	unsigned int last = plane->height - band->line - band->lines_count;
+
+	switch (plane->rotation) {
+		case 1:
+			return last * step;
+		case 2:
+			return last * plane->pitch;
+		case 3:
+			return band->line * step;
+		default:
+			return (band->line >> plane->shift) * plane->pitch;
+	}
+}
+
+static void detile_band(struct detile_band *band)
+{
+	struct detile_plane *plane = band->plane;
+	unsigned int source_pitch;
+	unsigned char *source;
+	unsigned char *destination;
+	unsigned char *destination2 = NULL;
+	unsigned int offset;
+
+	/* A tile row spans the aligned width over the tile height. */
+	source_pitch = (plane->source_width + TILED_YUV_TILE_WIDTH - 1) & ~(TILED_YUV_TILE_WIDTH - 1);
+
+	offset = detile_band_offset(plane, band);
+
+	destination = (unsigned char *) plane->destination + offset;
+	if (plane->destination2 != NULL)
+		destination2 = (unsigned char *) plane->destination2 + offset;
+
+	if (plane->rotation != 0 || plane->flip) {
+		tiled_to_planar_rotated(plane->source, plane->source_width, destination, destination2, plane->pitch, plane->x, plane->y + band->line, plane->width, band->lines_count, plane->rotation, plane->flip, plane->interleaved);
+		return;
+	}
+
+	if (plane->shift != 0) {
+		tiled_to_planar_scaled(plane->source, plane->source_width, destination, destination2, plane->pitch, plane->x, plane->y + band->line, plane->width, band->lines_count, plane->shift, plane->interleaved);
+		return;
+	}
+
+	if (plane->rgb != NULL) {
+		tiled_to_rgb(plane->source, plane->source2, plane->source_width, destination, plane->pitch, plane->x, plane->y + band->line, plane->width, band->lines_count, plane->rgb);
+		return;
+	}
+
+	/* Rectangles that do not span whole tile rows are copied in runs. */
+	if (plane->x != 0 || plane->y % TILED_YUV_TILE_HEIGHT != 0 || ((plane->width + TILED_YUV_TILE_WIDTH - 1) & ~(TILED_YUV_TILE_WIDTH - 1)) != source_pitch) {
+		if (destination2 != NULL)
+			tiled_deinterleave_to_planar_rect(plane->source, plane->source_width, destination, destination2, plane->pitch, plane->x, plane->y + band->line, plane->width, band->lines_count);
+		else
+			tiled_to_planar_rect(plane->source, plane->source_width, destination, plane->pitch, plane->x, plane->y + band->line, plane->width, band->lines_count);
+
+		return;
+	}
+
+	source = (unsigned char *) plane->source + (plane->y + band->line) * source_pitch;
+
+	if (destination2 != NULL)
+		tiled_deinterleave_to_planar(source, destination, destination2, plane->pitch, plane->width, band->lines_count);
+	else
+		tiled_to_planar(source, destination, plane->pitch, plane->width, band->lines_count);
+}
+
+/* Runs pending bands until there are none left, with the mutex held. */
+static void detile_pool_work(struct detile_pool *pool)
+{
+	struct detile_band *band;
+
+	while (pool->bands_next < pool->bands_count) {
+		band = &pool->bands[pool->bands_next];
+		pool->bands_next++;
+
+		pthread_mutex_unlock(&pool->mutex);
+		detile_band(band);
+		pthread_mutex_lock(&pool->mutex);
+
+		pool->bands_pending--;
+		if (pool->bands_pending == 0)
+			pthread_cond_broadcast(&pool->done_cond);
+	}
+}
+
+static void *detile_pool_loop(void *data)
+{
+	struct detile_pool *pool = (struct detile_pool *) data;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (!pool->stopping) {
+		if (pool->bands_next < pool->bands_count)
+			detile_pool_work(pool);
+		else
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+int detile_pool_init(struct detile_pool *pool)
+{
+	unsigned int threads_count;
+	char *threads_value;
+	long value;
+	unsigned int i;
+	int rc;
+
+	memset(pool, 0, sizeof(*pool));
+
+	threads_value = getenv("LIBVA_CEDRUS_DETILE_THREADS");
+	if (threads_value != NULL)
+		value = strtol(threads_value, NULL, 10);
+	else
+		value = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (value < 1)
+		value = 1;
+	else if (value > DETILE_THREADS_MAX)
+		value = DETILE_THREADS_MAX;
+
+	threads_count = value;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* The calling thread counts as one of the detiling threads. */
+	for (i = 0; i < threads_count - 1; i++) {
+		rc = pthread_create(&pool->threads[i], NULL, detile_pool_loop, pool);
+		if (rc != 0)
+			break;
+
+		pool->threads_count++;
+	}
+
+	return 0;
+}
+
+void detile_pool_destroy(struct detile_pool *pool)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->threads_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pool->threads_count = 0;
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+void detile_pool_run(struct detile_pool *pool, struct detile_plane *planes,
+	unsigned int planes_count)
+{
+	struct detile_band band;
+	unsigned int bands_per_plane;
+	unsigned int lines_count;
+	unsigned int line;
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	/* Another image is being detiled: do this one on the calling thread. */
+	if (pool->threads_count == 0 || pool->busy || planes_count > DETILE_PLANES_MAX) {
+		pthread_mutex_unlock(&pool->mutex);
+
+		for (i = 0; i < planes_count; i++) {
+			band.plane = &planes[i];
+			band.line = 0;
+			band.lines_count = planes[i].height;
+
+			detile_band(&band);
+		}
+
+		return;
+	}
+
+	pool->busy = true;
+	pool->bands_count = 0;
+	pool->bands_next = 0;
+
+	bands_per_plane = pool->threads_count + 1;
+
+	for (i = 0; i < planes_count; i++) {
+		pool->planes[i] = planes[i];
+
+		lines_count = (planes[i].height + bands_per_plane - 1) / bands_per_plane;
+		lines_count = (lines_count + TILED_YUV_TILE_HEIGHT - 1) & ~(TILED_YUV_TILE_HEIGHT - 1);
+
+		for (line = 0; line < planes[i].height; line += lines_count) {
+			pool->bands[pool->bands_count].plane = &pool->planes[i];
+			pool->bands[pool->bands_count].line = line;
+			pool->bands[pool->bands_count].lines_count = planes[i].height - line < lines_count ? planes[i].height - line : lines_count;
+			pool->bands_count++;
+		}
+	}
+
+	pool->bands_pending = pool->bands_count;
+
+	pthread_cond_broadcast(&pool->cond);
+
+	detile_pool_work(pool);
+
+	while (pool->bands_pending > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+	pool->bands_count = 0;
+	pool->bands_next = 0;
+	pool->busy = false;
+
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _DETILE_H_
+#define _DETILE_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "tiled_yuv.h"
+
+/* The calling thread takes part in detiling, along with the workers. */
+#define DETILE_THREADS_MAX					8
+#define DETILE_PLANES_MAX					3
+#define DETILE_BANDS_MAX					(DETILE_PLANES_MAX * DETILE_THREADS_MAX)
+
+/*
+ * A width by height rectangle at x, y of a tiled plane source_width wide.
+ * Interleaved data is split between both destinations when there is a second
+ * one, with the width still counted in interleaved bytes. With an RGB
+ * conversion, the second source is the chroma plane and pixels are converted.
+ * With a scale shift, boxes of 2^shift samples are averaged to one, with the
+ * rectangle still counted in source samples. Rotation is in clockwise quarter
+ * turns, applied after mirroring horizontally when flip is set.
+ */
+struct detile_plane {
+	void *source;
+	void *source2;
+	unsigned int source_width;
+	unsigned int x;
+	unsigned int y;
+	void *destination;
+	void *destination2;
+	unsigned int pitch;
+	unsigned int width;
+	unsigned int height;
+	unsigned int shift;
+	unsigned int rotation;
+	bool flip;
+	bool interleaved;
+	const struct tiled_yuv_rgb *rgb;
+};
+
+struct detile_band {
+	struct detile_plane *plane;
+	unsigned int line;
+	unsigned int lines_count;
+};
+
+struct detile_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_cond_t done_cond;
+
+	pthread_t threads[DETILE_THREADS_MAX];
+	unsigned int threads_count;
+
+	struct detile_plane planes[DETILE_PLANES_MAX];
+	struct detile_band bands[DETILE_BANDS_MAX];
+	unsigned int bands_count;
+	unsigned int bands_next;
+	unsigned int bands_pending;
+
+	bool busy;
+	bool stopping;
+};
+
+int detile_pool_init(struct detile_pool *pool);
+void detile_pool_destroy(struct detile_pool *pool);
+void detile_pool_run(struct detile_pool *pool, struct detile_plane *planes,
+	unsigned int planes_count);
+
+#endif
@@ -30,11 +30,259 @@
 
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
+#include <sys/mman.h>
+
+#include "detile.h"
 #include "tiled_yuv.h"
+#include "readback.h"
 
-VAStatus SunxiCedrusCreateImage(VADriverContextP context, VAImageFormat *format,
-	int width, int height, VAImage *image)
+static const unsigned int image_fourccs[] = {
+	VA_FOURCC_NV12,
+	VA_FOURCC_I420,
+	VA_FOURCC_YV12,
+	VA_FOURCC_Y800,
+	VA_FOURCC_RGBA,
+	VA_FOURCC_RGBX,
+	VA_FOURCC_BGRA,
+};
+
+bool image_fourcc_supported(unsigned int fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(image_fourccs) / sizeof(image_fourccs[0]); i++)
+		if (image_fourccs[i] == fourcc)
+			return true;
+
+	return false;
+}
+
+static bool image_fourcc_rgb(unsigned int fourcc)
+{
+	return fourcc == VA_FOURCC_RGBA || fourcc == VA_FOURCC_RGBX || fourcc == VA_FOURCC_BGRA;
+}
+
+/*
+ * Images are mirrored horizontally and then rotated by quarter turns, with
+ * vertical mirroring being horizontal mirroring followed by a half turn.
+ */
+static void image_orientation(struct sunxi_cedrus_driver_data *driver_data,
+	unsigned int rotation, unsigned int *quarters, bool *flip)
+{
+	*quarters = rotation;
+	*flip = driver_data->mirror != 0;
+
+	if (driver_data->mirror & SUNXI_CEDRUS_MIRROR_VERTICAL)
+		*quarters = (rotation + 2) % 4;
+}
+
+/*
+ * Fills the format and planes layout of an image. Lines are aligned to the
+ * tiles width, which keeps chroma lines of planar formats 16-byte aligned.
+ * Y800 only has the luma plane and RGB formats store each pixel as 4 bytes
+ * in memory order.
+ */
+int image_layout(unsigned int fourcc, int width, int height, VAImage *image)
+{
+	unsigned int pitch = (width + 31) & ~31;
+	unsigned int chroma_lines = (height + 1) / 2;
+
+	memset(image, 0, sizeof(*image));
+
+	switch (fourcc) {
+		case VA_FOURCC_NV12:
+			image->num_planes = 2;
+			image->pitches[0] = pitch;
+			image->pitches[1] = pitch;
+			image->offsets[0] = 0;
+			image->offsets[1] = pitch * height;
+			image->data_size = image->offsets[1] + pitch * chroma_lines;
+			break;
+
+		case VA_FOURCC_I420:
+		case VA_FOURCC_YV12:
+			image->num_planes = 3;
+			image->pitches[0] = pitch;
+			image->pitches[1] = pitch / 2;
+			image->pitches[2] = pitch / 2;
+			image->offsets[0] = 0;
+			image->offsets[1] = pitch * height;
+			image->offsets[2] = image->offsets[1] + pitch / 2 * chroma_lines;
+			image->data_size = image->offsets[2] + pitch / 2 * chroma_lines;
+			break;
+
+		case VA_FOURCC_Y800:
+			image->num_planes = 1;
+			image->pitches[0] = pitch;
+			image->offsets[0] = 0;
+			image->data_size = pitch * height;
+
+			image->format.bits_per_pixel = 8;
+			image->format.depth = 8;
+			break;
+
+		case VA_FOURCC_RGBA:
+		case VA_FOURCC_RGBX:
+		case VA_FOURCC_BGRA:
+			image->num_planes = 1;
+			image->pitches[0] = pitch * 4;
+			image->offsets[0] = 0;
+			image->data_size = pitch * 4 * height;
+
+			image->format.bits_per_pixel = 32;
+			image->format.depth = fourcc == VA_FOURCC_RGBX ? 24 : 32;
+			image->format.red_mask = fourcc == VA_FOURCC_BGRA ? 0x00ff0000 : 0x000000ff;
+			image->format.green_mask = 0x0000ff00;
+			image->format.blue_mask = fourcc == VA_FOURCC_BGRA ? 0x000000ff : 0x00ff0000;
+			image->format.alpha_mask = fourcc == VA_FOURCC_RGBX ? 0 : 0xff000000;
+			break;
+
+		default:
+			return -1;
+	}
+
+	image->format.fourcc = fourcc;
+	image->format.byte_order = VA_LSB_FIRST;
+	if (image->format.bits_per_pixel == 0)
+		image->format.bits_per_pixel = 12;
+	image->width = width;
+	image->height = height;
+
+	return 0;
+}
+
+/*
+ * Copies a rectangle of the picture to an image. Chroma covers the rectangle
+ * aligned down to even coordinates. For planar formats, the interleaved
+ * chroma is split to the U and V planes in the same pass. RGB formats are
+ * converted while detiling, reading both planes at once, and Y800 only reads
+ * the luma plane. YUV formats can be scaled down by 2^shift on the way,
+ * averaging boxes of samples, or rotated and mirrored at full scale.
+ */
+void image_copy(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object, unsigned int x, unsigned int y,
+	unsigned int width, unsigned int height, unsigned int shift,
+	unsigned int rotation, void *data, VAImage *image)
+{
+	struct detile_plane planes[2];
+	unsigned int planes_count = 2;
+	unsigned int quarters;
+	bool flip;
+	unsigned char *source;
+	unsigned char *destination;
+	unsigned char *destination2;
+	unsigned int line;
+	unsigned int i, j;
+
+	planes[0].source = surface_object->destination_data[0];
+	planes[0].x = x;
+	planes[0].y = y;
+	planes[0].width = width;
+	planes[0].height = height;
+	planes[0].destination = (unsigned char *) data + image->offsets[0];
+	planes[0].destination2 = NULL;
+	planes[0].pitch = image->pitches[0];
+	planes[0].shift = shift;
+	planes[0].interleaved = false;
+	planes[0].rgb = NULL;
+
+	planes[1].source = surface_object->destination_data[1];
+	planes[1].x = x & ~1;
+	planes[1].y = y / 2;
+	planes[1].width = ((width + 1) / 2) * 2;
+	planes[1].height = (height + 1) / 2;
+	planes[1].pitch = image->pitches[1];
+	planes[1].shift = shift;
+	planes[1].interleaved = true;
+	planes[1].rgb = NULL;
+
+	switch (image->format.fourcc) {
+		case VA_FOURCC_I420:
+			planes[1].destination = (unsigned char *) data + image->offsets[1];
+			planes[1].destination2 = (unsigned char *) data + image->offsets[2];
+			break;
+
+		case VA_FOURCC_YV12:
+			planes[1].destination = (unsigned char *) data + image->offsets[2];
+			planes[1].destination2 = (unsigned char *) data + image->offsets[1];
+			break;
+
+		case VA_FOURCC_Y800:
+			planes_count = 1;
+			break;
+
+		case VA_FOURCC_RGBA:
+		case VA_FOURCC_RGBX:
+			planes[0].source2 = surface_object->destination_data[1];
+			planes[0].rgb = &driver_data->rgb_conversion;
+			planes_count = 1;
+			break;
+
+		case VA_FOURCC_BGRA:
+			planes[0].source2 = surface_object->destination_data[1];
+			planes[0].rgb = &driver_data->bgr_conversion;
+			planes_count = 1;
+			break;
+
+		default:
+			planes[1].destination = (unsigned char *) data + image->offsets[1];
+			planes[1].destination2 = NULL;
+			break;
+	}
+
+	image_orientation(driver_data, rotation, &quarters, &flip);
+
+	for (i = 0; i < 2; i++) {
+		planes[i].source_width = surface_object->width;
+		planes[i].rotation = quarters;
+		planes[i].flip = flip;
+	}
+
+	if (driver_data->capture_format != V4L2_PIX_FMT_NV12M) {
+		detile_pool_run(&driver_data->detile_pool, planes, planes_count);
+		return;
+	}
+
+	if (planes[0].rgb != NULL) {
+		nv12_to_rgb(planes[0].source, planes[0].source2, surface_object->destination_pitch, planes[0].destination, planes[0].pitch, x, y, width, height, planes[0].rgb);
+		return;
+	}
+
+	for (i = 0; i < planes_count; i++) {
+		if (shift != 0) {
+			linear_to_planar_scaled(planes[i].source, surface_object->destination_pitch, planes[i].destination, planes[i].destination2, planes[i].pitch, planes[i].x, planes[i].y, planes[i].width, planes[i].height, shift, planes[i].interleaved);
+			continue;
+		}
+
+		if (quarters != 0 || flip) {
+			linear_to_planar_rotated(planes[i].source, surface_object->destination_pitch, planes[i].destination, planes[i].destination2, planes[i].pitch, planes[i].x, planes[i].y, planes[i].width, planes[i].height, quarters, flip, planes[i].interleaved);
+			continue;
+		}
+
+		for (line = 0; line < planes[i].height; line++) {
+			source = (unsigned char *) planes[i].source + (planes[i].y + line) * surface_object->destination_pitch + planes[i].x;
+			destination = (unsigned char *) planes[i].destination + line * planes[i].pitch;
+
+			if (planes[i].destination2 == NULL) {
+				memcpy(destination, source, planes[i].width);
+				continue;
+			}
+
+			destination2 = (unsigned char *) planes[i].destination2 + line * planes[i].pitch;
+
+			for (j = 0; j < planes[i].width / 2; j++) {
+				destination[j] = source[j * 2];
+				destination2[j] = source[j * 2 + 1];
+			}
+		}
+	}
+}
+
+/* Creates an image with the given layout, around existing data if any. */
+static VAStatus image_create(VADriverContextP context, VAImage *image,
+	void *data)
 {
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
@@ -42,47 +290,102 @@ VAStatus SunxiCedrusCreateImage(VADriverContextP context, VAImageFormat *format,
 	VABufferID buffer_id;
 	VAImageID id;
 	VAStatus status;
-	int sizeY, sizeUV;
-
-	sizeY = width * height;
-	sizeUV = (width * (height + 1) / 2);
+	unsigned int i;
 
 	id = object_heap_allocate(&driver_data->image_heap);
 	image_object = IMAGE(id);
 	if (image_object == NULL)
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
-	status = SunxiCedrusCreateBuffer(context, 0, VAImageBufferType, sizeY + sizeUV, 1, NULL, &buffer_id);
+	if (data != NULL)
+		status = buffer_wrap(driver_data, VAImageBufferType, data, image->data_size, &buffer_id);
+	else
+		status = SunxiCedrusCreateBuffer(context, 0, VAImageBufferType, image->data_size, 1, NULL, &buffer_id);
+
 	if (status != VA_STATUS_SUCCESS) {
 		object_heap_free(&driver_data->image_heap, (struct object_base *) image_object);
 		return status;
 	}
 
 	image_object->buffer_id = buffer_id;
+	image_object->surface_id = VA_INVALID_ID;
+	image_object->readback_data = NULL;
+	image_object->readback_size = 0;
 
-	memset(image, 0, sizeof(*image));
+	for (i = 0; i < 2; i++) {
+		image_object->destination_data[i] = NULL;
+		image_object->destination_size[i] = 0;
+	}
 
-	image->format = *format;
-	image->width = width;
-	image->height = height;
-	image->num_planes = 2;
-	image->pitches[0] = (width + 31) & ~31;
-	image->pitches[1] = (width + 31) & ~31;
-	image->offsets[0] = 0;
-	image->offsets[1] = sizeY;
-	image->data_size  = sizeY + sizeUV;
 	image->buf = buffer_id;
 	image->image_id = id;
 
+	image_object->image = *image;
+
 	return VA_STATUS_SUCCESS;
 }
 
+VAStatus SunxiCedrusCreateImage(VADriverContextP context, VAImageFormat *format,
+	int width, int height, VAImage *image)
+{
+	int rc;
+
+	rc = image_layout(format->fourcc, width, height, image);
+	if (rc < 0)
+		return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+
+	return image_create(context, image, NULL);
+}
+
+/* Tells whether a derived image still wraps the readback copy of a surface. */
+bool image_wraps_readback(struct sunxi_cedrus_driver_data *driver_data,
+	void *data)
+{
+	struct object_image *image_object;
+	object_heap_iterator iterator;
+
+	image_object = (struct object_image *) object_heap_first(&driver_data->image_heap, &iterator);
+	while (image_object != NULL) {
+		if (image_object->readback_data == data)
+			return true;
+
+		image_object = (struct object_image *) object_heap_next(&driver_data->image_heap, &iterator);
+	}
+
+	return false;
+}
+
+/* Tells whether a derived image still wraps the capture planes of a surface. */
+bool image_wraps_destination(struct sunxi_cedrus_driver_data *driver_data,
+	void *data)
+{
+	struct object_image *image_object;
+	object_heap_iterator iterator;
+
+	image_object = (struct object_image *) object_heap_first(&driver_data->image_heap, &iterator);
+	while (image_object != NULL) {
+		if (image_object->destination_data[0] == data)
+			return true;
+
+		image_object = (struct object_image *) object_heap_next(&driver_data->image_heap, &iterator);
+	}
+
+	return false;
+}
+
 VAStatus SunxiCedrusDestroyImage(VADriverContextP context, VAImageID image_id)
 {
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_image *image_object;
+	struct object_surface *surface_object;
+	VASurfaceID surface_id;
+	void *readback_data;
+	unsigned int readback_size;
+	void *destination_data[2];
+	unsigned int destination_size[2];
 	VAStatus status;
+	unsigned int i;
 
 	image_object = IMAGE(image_id);
 	if (image_object == NULL)
@@ -92,8 +395,37 @@ VAStatus SunxiCedrusDestroyImage(VADriverContextP context, VAImageID image_id)
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
+	surface_id = image_object->surface_id;
+	readback_data = image_object->readback_data;
+	readback_size = image_object->readback_size;
+
+	for (i = 0; i < 2; i++) {
+		destination_data[i] = image_object->destination_data[i];
+		destination_size[i] = image_object->destination_size[i];
+	}
+
+	pthread_mutex_lock(&driver_data->mutex);
+
 	object_heap_free(&driver_data->image_heap, (struct object_base *) image_object);
 
+	/* The copy of a destroyed surface goes away with the last image using it. */
+	if (readback_data != NULL) {
+		surface_object = SURFACE(surface_id);
+		if ((surface_object == NULL || surface_object->readback_data != readback_data) && !image_wraps_readback(driver_data, readback_data))
+			buffer_pool_free_image(&driver_data->buffer_pool, readback_data, readback_size);
+	}
+
+	/* So do the capture planes, which stay mapped until then. */
+	if (destination_data[0] != NULL) {
+		surface_object = SURFACE(surface_id);
+		if ((surface_object == NULL || surface_object->destination_data[0] != destination_data[0]) && !image_wraps_destination(driver_data, destination_data[0]))
+			for (i = 0; i < 2; i++)
+				if (destination_data[i] != NULL && destination_size[i] > 0)
+					munmap(destination_data[i], destination_size[i]);
+	}
+
+	pthread_mutex_unlock(&driver_data->mutex);
+
 	return VA_STATUS_SUCCESS;
 }
 
@@ -103,9 +435,12 @@ VAStatus SunxiCedrusDeriveImage(VADriverContextP context,
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_surface *surface_object;
-	struct object_buffer *buffer_object;
-	VAImageFormat format;
+	struct object_image *image_object;
 	VAStatus status;
+	bool oriented;
+	void *data;
+	unsigned int i;
+	int rc;
 
 	surface_object = SURFACE(surface_id);
 	if (surface_object == NULL)
@@ -115,34 +450,100 @@ VAStatus SunxiCedrusDeriveImage(VADriverContextP context,
 		status = SunxiCedrusSyncSurface(context, surface_id);
 		if (status != VA_STATUS_SUCCESS)
 			return status;
-	} else if (surface_object->status == VASurfaceReady) {
-		return VA_STATUS_SUCCESS;
 	}
 
-	format.fourcc = VA_FOURCC_NV12;
+	pthread_mutex_lock(&driver_data->mutex);
+
+	oriented = driver_data->rotation != VA_ROTATION_NONE || driver_data->mirror != 0;
+
+	/* Linear pictures are handed out straight from the capture buffers. */
+	if (driver_data->capture_format == V4L2_PIX_FMT_NV12M && (driver_data->derive_fourcc == VA_FOURCC_NV12 || driver_data->derive_fourcc == VA_FOURCC_Y800) && !oriented) {
+		/* The planes are mapped when the surface is created, decoded or not. */
+		image_layout(driver_data->derive_fourcc, surface_object->width, surface_object->height, image);
+
+		data = surface_object->destination_data[0];
+		image->pitches[0] = surface_object->destination_pitch;
+		image->data_size = surface_object->destination_size[0];
+
+		if (driver_data->derive_fourcc == VA_FOURCC_NV12) {
+			image->pitches[1] = surface_object->destination_pitch;
+			image->offsets[1] = (unsigned char *) surface_object->destination_data[1] - (unsigned char *) surface_object->destination_data[0];
+			image->data_size = image->offsets[1] + surface_object->destination_size[1];
+		}
+	} else {
+		if (oriented && image_fourcc_rgb(driver_data->derive_fourcc)) {
+			status = VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+			goto complete;
+		}
 
-	status = SunxiCedrusCreateImage(context, &format, surface_object->width, surface_object->height, image);
+		/* Background readback might still be working on the surface. */
+		readback_wait_surface(driver_data, surface_object);
+
+		/* The linear copy of the picture is reused until it is decoded again. */
+		if (readback_cached(driver_data, surface_object)) {
+			driver_data->readback_hits++;
+		} else if (surface_object->status != VASurfaceRendering) {
+			driver_data->readback_misses++;
+
+			/* TODO: Use an appropriate DRM plane instead */
+			rc = readback_surface(driver_data, surface_object);
+			if (rc < 0) {
+				status = VA_STATUS_ERROR_OPERATION_FAILED;
+				goto complete;
+			}
+		} else {
+			/* Decoding was started again since the surface was synced. */
+			status = VA_STATUS_ERROR_SURFACE_BUSY;
+			goto complete;
+		}
+
+		if (surface_object->readback_rotation == VA_ROTATION_90 || surface_object->readback_rotation == VA_ROTATION_270)
+			image_layout(driver_data->derive_fourcc, surface_object->height, surface_object->width, image);
+		else
+			image_layout(driver_data->derive_fourcc, surface_object->width, surface_object->height, image);
+
+		data = surface_object->readback_data;
+	}
+
+	status = image_create(context, image, data);
 	if (status != VA_STATUS_SUCCESS)
-		return status;
+		goto complete;
 
-	buffer_object = BUFFER(image->buf);
-	if (buffer_object == NULL)
-		return VA_STATUS_ERROR_INVALID_BUFFER;
+	image_object = IMAGE(image->image_id);
+	image_object->surface_id = surface_id;
 
-	/* TODO: Use an appropriate DRM plane instead */
-	tiled_to_planar(surface_object->destination_data[0], buffer_object->data, image->pitches[0], image->width, image->height);
-	tiled_to_planar(surface_object->destination_data[1], buffer_object->data + image->width*image->height, image->pitches[1], image->width, image->height/2);
+	if (data == surface_object->readback_data) {
+		image_object->readback_data = surface_object->readback_data;
+		image_object->readback_size = surface_object->readback_size;
+	} else if (data == surface_object->destination_data[0]) {
+		for (i = 0; i < 2; i++) {
+			image_object->destination_data[i] = surface_object->destination_data[i];
+			image_object->destination_size[i] = surface_object->destination_size[i];
+		}
+	}
 
 	surface_object->status = VASurfaceReady;
 
-	return VA_STATUS_SUCCESS;
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
 }
 
 VAStatus SunxiCedrusQueryImageFormats(VADriverContextP context,
 	VAImageFormat *formats, int *formats_count)
 {
-	formats[0].fourcc = VA_FOURCC_NV12;
-	*formats_count = 1;
+	VAImage image;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(image_fourccs) / sizeof(image_fourccs[0]); i++) {
+		image_layout(image_fourccs[i], 0, 0, &image);
+		formats[i] = image.format;
+	}
+
+	*formats_count = i;
 
 	return VA_STATUS_SUCCESS;
 }
@@ -157,7 +558,91 @@ VAStatus SunxiCedrusGetImage(VADriverContextP context, VASurfaceID surface_id,
 	int x, int y, unsigned int width, unsigned int height,
 	VAImageID image_id)
 {
-	return VA_STATUS_SUCCESS;
+	struct sunxi_cedrus_driver_data *driver_data =
+		(struct sunxi_cedrus_driver_data *) context->pDriverData;
+	struct object_surface *surface_object;
+	struct object_image *image_object;
+	struct object_buffer *buffer_object;
+	VAImage *image;
+	unsigned int image_width, image_height;
+	unsigned int rotation;
+	unsigned int shift;
+	VAStatus status;
+
+	surface_object = SURFACE(surface_id);
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	image_object = IMAGE(image_id);
+	if (image_object == NULL)
+		return VA_STATUS_ERROR_INVALID_IMAGE;
+
+	image = &image_object->image;
+
+	buffer_object = BUFFER(image->buf);
+	if (buffer_object == NULL || buffer_object->data == NULL)
+		return VA_STATUS_ERROR_INVALID_BUFFER;
+
+	if (x < 0 || y < 0 || x + width > surface_object->width || y + height > surface_object->height)
+		return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&driver_data->mutex);
+
+	rotation = driver_data->rotation;
+
+	/* Quarter turns swap the dimensions of the rectangle in the image. */
+	image_width = image->width;
+	image_height = image->height;
+
+	if (rotation == VA_ROTATION_90 || rotation == VA_ROTATION_270) {
+		image_width = image->height;
+		image_height = image->width;
+	}
+
+	/*
+	 * Images at least as large as the rectangle get a plain copy, others
+	 * must be exactly the rectangle scaled down by 2, 4 or 8.
+	 */
+	if (width <= image_width && height <= image_height)
+		shift = 0;
+	else
+		for (shift = 1; shift <= 3; shift++)
+			if (((width + (1 << shift) - 1) >> shift) == image_width && ((height + (1 << shift) - 1) >> shift) == image_height)
+				break;
+
+	if (shift > 3 || (shift != 0 && (rotation != VA_ROTATION_NONE || driver_data->mirror != 0))) {
+		status = VA_STATUS_ERROR_INVALID_PARAMETER;
+		goto complete;
+	}
+
+	if ((shift != 0 || rotation != VA_ROTATION_NONE || driver_data->mirror != 0) && image_fourcc_rgb(image->format.fourcc)) {
+		status = VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+		goto complete;
+	}
+
+	if (surface_object->status == VASurfaceRendering) {
+		status = surface_sync(driver_data, surface_object);
+		if (status != VA_STATUS_SUCCESS)
+			goto complete;
+	}
+
+	/* The surface cannot be rendered to while it is being read. */
+	readback_wait_surface(driver_data, surface_object);
+	surface_object->readback_busy = true;
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	image_copy(driver_data, surface_object, x, y, width, height, shift, rotation, buffer_object->data, image);
+
+	pthread_mutex_lock(&driver_data->mutex);
+	surface_object->readback_busy = false;
+	pthread_cond_broadcast(&driver_data->cond);
+
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
 }
 
 VAStatus SunxiCedrusPutImage(VADriverContextP context, VASurfaceID surface_id,
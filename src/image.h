@@ -26,9 +26,13 @@
 #ifndef _IMAGE_H_
 #define _IMAGE_H_
 
+#include <stdbool.h>
+
 #include <va/va_backend.h>
 
 #include "object_heap.h"
+#include "sunxi_cedrus.h"
+#include "surface.h"
 
 #define IMAGE(id)   ((struct object_image *)   object_heap_lookup(&driver_data->image_heap,   id))
 #define IMAGE_ID_OFFSET			0x10000000
@@ -36,8 +40,28 @@
 struct object_image {
 	struct object_base base;
 	VABufferID buffer_id;
+	VAImage image;
+
+	/* Readback copy wrapped by a derived image, freed with its last user. */
+	VASurfaceID surface_id;
+	void *readback_data;
+	unsigned int readback_size;
+
+	/* Linear capture planes wrapped instead, unmapped with the last user. */
+	void *destination_data[2];
+	unsigned int destination_size[2];
 };
 
+bool image_fourcc_supported(unsigned int fourcc);
+bool image_wraps_readback(struct sunxi_cedrus_driver_data *driver_data,
+	void *data);
+bool image_wraps_destination(struct sunxi_cedrus_driver_data *driver_data,
+	void *data);
+int image_layout(unsigned int fourcc, int width, int height, VAImage *image);
+void image_copy(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object, unsigned int x, unsigned int y,
+	unsigned int width, unsigned int height, unsigned int shift,
+	unsigned int rotation, void *data, VAImage *image);
 VAStatus SunxiCedrusCreateImage(VADriverContextP context, VAImageFormat *format,
 	int width, int height, VAImage *image);
 VAStatus SunxiCedrusDestroyImage(VADriverContextP context, VAImageID image_id);
@@ -73,9 +73,9 @@ int media_request_queue(int request_fd)
 	return 0;
 }
 
-int media_request_wait_completion(int request_fd)
+int media_request_wait_completion(int request_fd, unsigned int timeout)
 {
-	struct timeval tv = { 0, 300000 };
+	struct timeval tv = { timeout / 1000000, timeout % 1000000 };
         fd_set except_fds;
 	int rc;
 
@@ -28,6 +28,6 @@
 int media_request_alloc(int media_fd);
 int media_request_reinit(int request_fd);
 int media_request_queue(int request_fd);
-int media_request_wait_completion(int request_fd);
+int media_request_wait_completion(int request_fd, unsigned int timeout);
 
 #endif
@@ -27,6 +27,7 @@
 #include "mpeg2.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
 
 #include <sys/mman.h>
@@ -34,6 +35,27 @@
 
 #include <linux/videodev2.h>
 
+#include "bitstream.h"
+#include "utils.h"
+
+/*
+ * A coded picture never exceeds the VBV buffer, whose size is bounded by the
+ * level that the picture dimensions require. Pictures that are larger anyway
+ * get a bigger bitstream buffer when rendered.
+ */
+unsigned int mpeg2_source_size(VAProfile profile, unsigned int width,
+	unsigned int height)
+{
+	if (width <= 352 && height <= 288)
+		return MPEG2_VBV_SIZE_LOW;
+	else if (profile == VAProfileMPEG2Simple || (width <= 720 && height <= 576))
+		return MPEG2_VBV_SIZE_MAIN;
+	else if (width <= 1440 && height <= 1152)
+		return MPEG2_VBV_SIZE_HIGH_1440;
+	else
+		return MPEG2_VBV_SIZE_HIGH;
+}
+
 int mpeg2_fill_picture_parameters(struct sunxi_cedrus_driver_data *driver_data,
 	struct object_context *context_object,
 	struct object_surface *surface_object,
@@ -78,21 +100,167 @@ int mpeg2_fill_picture_parameters(struct sunxi_cedrus_driver_data *driver_data,
 	return 0;
 }
 
+int mpeg2_fill_quantization(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object,
+	VAIQMatrixBufferMPEG2 *parameters)
+{
+	struct v4l2_ctrl_mpeg2_quantization *quantization = &surface_object->mpeg2_quantization;
+
+	/* Both sides expect the matrices in zigzag scanning order. */
+	quantization->load_intra_quantiser_matrix = parameters->load_intra_quantiser_matrix;
+	quantization->load_non_intra_quantiser_matrix = parameters->load_non_intra_quantiser_matrix;
+	quantization->load_chroma_intra_quantiser_matrix = parameters->load_chroma_intra_quantiser_matrix;
+	quantization->load_chroma_non_intra_quantiser_matrix = parameters->load_chroma_non_intra_quantiser_matrix;
+
+	memcpy(quantization->intra_quantiser_matrix, parameters->intra_quantiser_matrix, sizeof(quantization->intra_quantiser_matrix));
+	memcpy(quantization->non_intra_quantiser_matrix, parameters->non_intra_quantiser_matrix, sizeof(quantization->non_intra_quantiser_matrix));
+	memcpy(quantization->chroma_intra_quantiser_matrix, parameters->chroma_intra_quantiser_matrix, sizeof(quantization->chroma_intra_quantiser_matrix));
+	memcpy(quantization->chroma_non_intra_quantiser_matrix, parameters->chroma_non_intra_quantiser_matrix, sizeof(quantization->chroma_non_intra_quantiser_matrix));
+
+	return 0;
+}
+
+int mpeg2_fill_slice_parameters(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object,
+	VASliceParameterBufferMPEG2 *parameters, unsigned int count)
+{
+	unsigned int i;
+
+	/*
+	 * The slice parameters come before their slice data, which is checked
+	 * against them when rendered.
+	 */
+	surface_object->slices_pending_count = count;
+
+	for (i = 0; i < count && i < SURFACE_SLICES_PENDING_MAX; i++) {
+		surface_object->slices_pending_offsets[i] = parameters[i].slice_data_offset;
+
+		/* Slices split across several buffers are not supported. */
+		if (parameters[i].slice_data_flag != VA_SLICE_DATA_FLAG_ALL)
+			surface_object->slices_pending_sizes[i] = UINT_MAX;
+		else
+			surface_object->slices_pending_sizes[i] = parameters[i].slice_data_size;
+	}
+
+	return 0;
+}
+
+/*
+ * Checks each pending slice against the start codes found in its data: every
+ * slice has to start with a slice start code, slices cannot overlap and no
+ * other start code can be around. Returns how many leading slices are
+ * complete, which is less than all of them when the data is truncated, or -1
+ * when the data does not match the parameters.
+ */
+static int mpeg2_check_slices(struct object_surface *surface_object,
+	unsigned char *p, unsigned int size, unsigned int count)
+{
+	unsigned int offset, end = 0;
+	unsigned int starts_count = 0;
+	int complete = -1;
+	unsigned int i;
+
+	if (surface_object->slices_pending_count > SURFACE_SLICES_PENDING_MAX)
+		return -1;
+
+	for (i = 0; i < surface_object->slices_pending_count; i++) {
+		offset = surface_object->slices_pending_offsets[i];
+
+		/* Slices starting past the data were cut off along with it. */
+		if (offset + BITSTREAM_START_CODE_SIZE >= size)
+			break;
+
+		if (offset < end || p[offset] != 0 || p[offset + 1] != 0 || p[offset + 2] != 1 ||
+		    p[offset + BITSTREAM_START_CODE_SIZE] < MPEG2_SLICE_START_CODE_MIN ||
+		    p[offset + BITSTREAM_START_CODE_SIZE] > MPEG2_SLICE_START_CODE_MAX)
+			return -1;
+
+		starts_count++;
+
+		if (complete < 0 && surface_object->slices_pending_sizes[i] > size - offset)
+			complete = i;
+
+		end = offset + surface_object->slices_pending_sizes[i];
+		if (end < offset)
+			end = UINT_MAX;
+	}
+
+	/* Start codes that no slice accounts for make the decoding time out. */
+	if (starts_count != count)
+		return -1;
+
+	return complete < 0 ? (int) i : complete;
+}
+
 int mpeg2_fill_slice_data(struct sunxi_cedrus_driver_data *driver_data,
 	struct object_context *context_object,
 	struct object_surface *surface_object, void *data, unsigned int size)
 {
+	struct v4l2_ctrl_mpeg2_frame_hdr *header = &surface_object->mpeg2_header;
 	unsigned char *p = (unsigned char *) surface_object->source_data +
 		surface_object->slices_size;
+	unsigned int first_offset;
+	unsigned int last_offset;
+	unsigned int count;
+	unsigned int length = size;
+	int complete;
+
+	if (surface_object->source_data == NULL || surface_object->slices_size + size > surface_object->source_size) {
+		sunxi_cedrus_log("Dropping slice data exceeding the bitstream buffer\n");
+		goto complete;
+	}
 
 	/*
 	 * Since there is no guarantee that the allocation order is the same as
 	 * the submission order (via RenderPicture), we can't use a V4L2 buffer
-	 * directly and have to copy from a regular buffer.
+	 * directly and have to copy from a regular buffer. The exception is
+	 * the first slice data with zero-copy, which already lives in the
+	 * V4L2 buffer bound to the surface and is only scanned.
 	 * */
-	memcpy(p, data, size);
+	count = bitstream_copy_scan(p != data ? p : NULL, data, size, &first_offset, &last_offset);
+
+	/*
+	 * Broken slices would only make the decoding time out, so they are
+	 * left out by not accounting for their data, which gets overwritten.
+	 */
+	if (count == 0 || first_offset + BITSTREAM_START_CODE_SIZE >= size ||
+	    p[first_offset + BITSTREAM_START_CODE_SIZE] < MPEG2_SLICE_START_CODE_MIN ||
+	    p[first_offset + BITSTREAM_START_CODE_SIZE] > MPEG2_SLICE_START_CODE_MAX) {
+		sunxi_cedrus_log("Dropping slice data without a valid slice start code\n");
+		goto complete;
+	}
+
+	if (surface_object->slices_pending_count > 0) {
+		complete = mpeg2_check_slices(surface_object, p, size, count);
+		if (complete < 0) {
+			sunxi_cedrus_log("Dropping slice data not matching the slice parameters\n");
+			goto complete;
+		}
+
+		/* Truncated data is trimmed to the last slice it contains in full. */
+		if ((unsigned int) complete < count) {
+			if (complete == 0) {
+				sunxi_cedrus_log("Dropping truncated slice data\n");
+				goto complete;
+			}
+
+			sunxi_cedrus_log("Trimming truncated slice data\n");
+			length = surface_object->slices_pending_offsets[complete];
+			count = complete;
+		}
+	}
+
+	/* The hardware parses the slice headers on its own from the first one. */
+	if (surface_object->slices_size == 0)
+		header->slice_pos = first_offset * 8;
+
+	surface_object->slices_size += length;
+	surface_object->slices_count += count;
 
-	surface_object->slices_size += size;
+complete:
+	surface_object->slices_pending_count = 0;
 
 	return 0;
 }
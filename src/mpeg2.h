@@ -33,10 +33,29 @@
 
 #include "surface.h"
 
+#define MPEG2_SLICE_START_CODE_MIN	0x01
+#define MPEG2_SLICE_START_CODE_MAX	0xaf
+
+/* Maximum VBV buffer sizes for each level, in bytes. */
+#define MPEG2_VBV_SIZE_LOW		(475136 / 8)
+#define MPEG2_VBV_SIZE_MAIN		(1835008 / 8)
+#define MPEG2_VBV_SIZE_HIGH_1440	(7340032 / 8)
+#define MPEG2_VBV_SIZE_HIGH		(9781248 / 8)
+
+unsigned int mpeg2_source_size(VAProfile profile, unsigned int width,
+	unsigned int height);
 int mpeg2_fill_picture_parameters(struct sunxi_cedrus_driver_data *driver_data,
 	struct object_context *context_object,
 	struct object_surface *surface_object,
 	VAPictureParameterBufferMPEG2 *parameters);
+int mpeg2_fill_quantization(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object,
+	VAIQMatrixBufferMPEG2 *parameters);
+int mpeg2_fill_slice_parameters(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object,
+	VASliceParameterBufferMPEG2 *parameters, unsigned int count);
 int mpeg2_fill_slice_data(struct sunxi_cedrus_driver_data *driver_data,
 	struct object_context *context_object,
 	struct object_surface *surface_object, void *data, unsigned int size);
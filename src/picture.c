@@ -36,6 +36,7 @@
 #include <string.h>
 
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 
@@ -43,6 +44,8 @@
 
 #include "v4l2.h"
 #include "media.h"
+#include "reactor.h"
+#include "readback.h"
 #include "utils.h"
 
 VAStatus SunxiCedrusBeginPicture(VADriverContextP context,
@@ -52,6 +55,7 @@ VAStatus SunxiCedrusBeginPicture(VADriverContextP context,
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_context *context_object;
 	struct object_surface *surface_object;
+	VAStatus status;
 
 	context_object = CONTEXT(context_id);
 	if (context_object == NULL)
@@ -61,13 +65,82 @@ VAStatus SunxiCedrusBeginPicture(VADriverContextP context,
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
+	pthread_mutex_lock(&driver_data->mutex);
+
 	if (surface_object->status == VASurfaceRendering)
-		SunxiCedrusSyncSurface(context, surface_id);
+		surface_sync(driver_data, surface_object);
+
+	readback_cancel_surface(driver_data, surface_object);
+
+	/*
+	 * A bitstream buffer is handed out from the context for the duration
+	 * of the decoding. With zero-copy, the buffer of the first slice data
+	 * is used instead.
+	 */
+	if (surface_object->source_data == NULL && !context_object->zero_copy) {
+		status = surface_acquire_source(driver_data, context_object, surface_object);
+		if (status != VA_STATUS_SUCCESS)
+			goto complete;
+	}
 
 	surface_object->status = VASurfaceRendering;
+	surface_object->context_id = context_id;
+	surface_object->slices_size = 0;
+	surface_object->slices_count = 0;
+	surface_object->slices_pending_count = 0;
+	surface_object->mpeg2_header.slice_pos = 0;
+	surface_object->sequence = context_object->sequence++;
+	surface_object->generation++;
+
+	/* Quantisation matrices are kept unless new ones are rendered. */
+	surface_object->mpeg2_quantization = context_object->mpeg2_quantization;
+
 	context_object->render_surface_id = surface_id;
 
-	return VA_STATUS_SUCCESS;
+	status = VA_STATUS_SUCCESS;
+
+complete:
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
+}
+
+/*
+ * Makes sure the surface has a bitstream buffer to hold the slice data. A
+ * slice data buffer backed by a bitstream buffer is bound to the surface when
+ * it comes first, so that its data is not copied.
+ */
+static VAStatus picture_prepare_slice_data(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object,
+	struct object_buffer *buffer_object)
+{
+	VAStatus status = VA_STATUS_SUCCESS;
+	unsigned int size = buffer_object->size * buffer_object->count;
+
+	pthread_mutex_lock(&driver_data->mutex);
+
+	if (buffer_object->source_index >= 0 && buffer_object->context_id == context_object->base.id && surface_object->slices_size == 0) {
+		surface_release_source(context_object, surface_object);
+		surface_bind_source(context_object, surface_object, buffer_object->source_index);
+
+		/* The bitstream buffer now belongs to the surface. */
+		buffer_object->source_index = -1;
+	} else if (surface_object->source_data == NULL) {
+		status = surface_acquire_source(driver_data, context_object, surface_object);
+	}
+
+	/*
+	 * Pictures larger than expected get a larger bitstream buffer. The
+	 * slice data that still doesn't fit is dropped when filled.
+	 */
+	if (status == VA_STATUS_SUCCESS && surface_object->slices_size + size > surface_object->source_size)
+		if (surface_grow_source(driver_data, context_object, surface_object, surface_object->slices_size + size) != VA_STATUS_SUCCESS)
+			sunxi_cedrus_log("Unable to grow the bitstream buffer to %u bytes\n", surface_object->slices_size + size);
+
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
 }
 
 VAStatus SunxiCedrusRenderPicture(VADriverContextP context,
@@ -80,8 +153,11 @@ VAStatus SunxiCedrusRenderPicture(VADriverContextP context,
 	struct object_surface *surface_object;
 	struct object_buffer *buffer_object;
 	VAPictureParameterBufferMPEG2 *mpeg2_parameters;
+	VAIQMatrixBufferMPEG2 *mpeg2_quantization;
+	VASliceParameterBufferMPEG2 *mpeg2_slice_parameters;
 	void *data;
 	unsigned int size;
+	VAStatus status;
 	int rc;
 	int i;
 
@@ -102,6 +178,25 @@ VAStatus SunxiCedrusRenderPicture(VADriverContextP context,
 		if (buffer_object == NULL)
 			return VA_STATUS_ERROR_INVALID_BUFFER;
 
+		/*
+		 * With slice submission, the slices received so far are
+		 * submitted when the parameters of the next ones come in.
+		 */
+		if (buffer_object->type == VASliceParameterBufferType && context_object->slice_submission) {
+			pthread_mutex_lock(&driver_data->mutex);
+			status = picture_submit_slice(driver_data, context_object, surface_object);
+			pthread_mutex_unlock(&driver_data->mutex);
+
+			if (status != VA_STATUS_SUCCESS)
+				return status;
+		}
+
+		if (buffer_object->type == VASliceDataBufferType) {
+			status = picture_prepare_slice_data(driver_data, context_object, surface_object, buffer_object);
+			if (status != VA_STATUS_SUCCESS)
+				return status;
+		}
+
 		switch (config_object->profile) {
 			case VAProfileMPEG2Simple:
 			case VAProfileMPEG2Main:
@@ -118,6 +213,18 @@ VAStatus SunxiCedrusRenderPicture(VADriverContextP context,
 					rc = mpeg2_fill_picture_parameters(driver_data, context_object, surface_object, mpeg2_parameters);
 					if (rc < 0)
 						return VA_STATUS_ERROR_OPERATION_FAILED;
+				} else if (buffer_object->type == VAIQMatrixBufferType) {
+					mpeg2_quantization = (VAIQMatrixBufferMPEG2 *) buffer_object->data;
+
+					rc = mpeg2_fill_quantization(driver_data, context_object, surface_object, mpeg2_quantization);
+					if (rc < 0)
+						return VA_STATUS_ERROR_OPERATION_FAILED;
+				} else if (buffer_object->type == VASliceParameterBufferType) {
+					mpeg2_slice_parameters = (VASliceParameterBufferMPEG2 *) buffer_object->data;
+
+					rc = mpeg2_fill_slice_parameters(driver_data, context_object, surface_object, mpeg2_slice_parameters, buffer_object->count);
+					if (rc < 0)
+						return VA_STATUS_ERROR_OPERATION_FAILED;
 				}
 				break;
 
@@ -135,70 +242,287 @@ VAStatus SunxiCedrusEndPicture(VADriverContextP context,
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_context *context_object;
-	struct object_config *config_object;
 	struct object_surface *surface_object;
-	void *control_data;
-	unsigned int control_size;
-	unsigned int control_id;
-	int request_fd;
 	VAStatus status;
-	int rc;
 
 	context_object = CONTEXT(context_id);
 	if (context_object == NULL)
 		return VA_STATUS_ERROR_INVALID_CONTEXT;
 
-	config_object = CONFIG(context_object->config_id);
-	if (config_object == NULL)
-		return VA_STATUS_ERROR_INVALID_CONFIG;
-
 	surface_object = SURFACE(context_object->render_surface_id);
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
-	request_fd = surface_object->request_fd;
-	if (request_fd < 0) {
-		request_fd = media_request_alloc(driver_data->media_fd);
-		if (request_fd < 0)
-			return VA_STATUS_ERROR_OPERATION_FAILED;
+	pthread_mutex_lock(&driver_data->mutex);
 
-		surface_object->request_fd = request_fd;
-	}
+	status = picture_submit(driver_data, context_object, surface_object);
+	if (status == VA_STATUS_SUCCESS)
+		context_object->render_surface_id = VA_INVALID_ID;
+
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
+}
+
+/*
+ * Sets the controls of the picture and queues its buffers to the request,
+ * before queuing the request itself. The capture buffer is only queued once
+ * for all the slices of the picture, which are held back by the driver until
+ * the last one.
+ */
+static VAStatus picture_queue_request(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object, int request_fd, bool hold)
+{
+	struct object_config *config_object;
+	struct v4l2_ext_control controls[PICTURE_CONTROLS_MAX];
+	unsigned int controls_count = 0;
+	struct timeval timestamp;
+	unsigned int flags;
+	bool quantization_changed;
+	int rc;
+
+	config_object = CONFIG(context_object->config_id);
+	if (config_object == NULL)
+		return VA_STATUS_ERROR_INVALID_CONFIG;
 
 	switch (config_object->profile) {
 		case VAProfileMPEG2Simple:
 		case VAProfileMPEG2Main:
-			surface_object->mpeg2_header.slice_pos = 0;
 			surface_object->mpeg2_header.slice_len = surface_object->slices_size * 8;
 
-			control_id = V4L2_CID_MPEG_VIDEO_MPEG2_FRAME_HDR;
-			control_data = &surface_object->mpeg2_header;
-			control_size = sizeof(surface_object->mpeg2_header);
+			memset(controls, 0, sizeof(controls));
+
+			controls[controls_count].id = V4L2_CID_MPEG_VIDEO_MPEG2_FRAME_HDR;
+			controls[controls_count].ptr = &surface_object->mpeg2_header;
+			controls[controls_count].size = sizeof(surface_object->mpeg2_header);
+			controls_count++;
+
+			/*
+			 * Quantisation matrices usually only change with the
+			 * sequence header, so they are only uploaded when they
+			 * differ from the ones the driver already has.
+			 */
+			quantization_changed = !context_object->mpeg2_quantization_uploaded ||
+				memcmp(&surface_object->mpeg2_quantization, &context_object->mpeg2_quantization, sizeof(surface_object->mpeg2_quantization)) != 0;
+
+			if (quantization_changed) {
+				controls[controls_count].id = V4L2_CID_MPEG_VIDEO_MPEG2_QUANTIZATION;
+				controls[controls_count].ptr = &surface_object->mpeg2_quantization;
+				controls[controls_count].size = sizeof(surface_object->mpeg2_quantization);
+				controls_count++;
+
+				context_object->mpeg2_quantization = surface_object->mpeg2_quantization;
+			}
 			break;
 
 		default:
 			return VA_STATUS_ERROR_UNSUPPORTED_PROFILE;
 	}
 
-	rc = v4l2_set_control(driver_data->video_fd, request_fd, control_id, control_data, control_size);
+	/*
+	 * All the controls of the picture are set with a single call. Until
+	 * the request is queued, they are lost if anything fails.
+	 */
+	context_object->mpeg2_quantization_uploaded = false;
+
+	rc = v4l2_set_controls(driver_data->video_fd, request_fd, controls, controls_count);
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	rc = v4l2_queue_buffer(driver_data->video_fd, request_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, surface_object->destination_index, 0);
+	/* Slices of the same picture are told apart by their timestamp. */
+	timestamp.tv_sec = surface_object->sequence / 1000000;
+	timestamp.tv_usec = surface_object->sequence % 1000000;
+
+	if (!surface_object->destination_queued) {
+		rc = v4l2_queue_buffer(driver_data->video_fd, context_object->slice_submission ? -1 : request_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, NULL, surface_object->destination_index, 0, 0);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+
+		surface_object->destination_queued = true;
+	}
+
+	flags = hold ? V4L2_BUF_FLAG_M2M_HOLD_CAPTURE_BUF : 0;
+
+	rc = v4l2_queue_buffer(driver_data->video_fd, request_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &timestamp, surface_object->source_index, surface_object->slices_size, flags);
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	rc = v4l2_queue_buffer(driver_data->video_fd, request_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, surface_object->source_index, surface_object->slices_size);
-	if (rc < 0)
+	/* The reactor is only concerned with the last request of the picture. */
+	if (!hold) {
+		rc = reactor_watch_request(driver_data, request_fd, surface_object);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	rc = media_request_queue(request_fd);
+	if (rc < 0) {
+		if (!hold)
+			reactor_unwatch_request(driver_data, request_fd);
+
 		return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
 
-	surface_object->slices_size = 0;
+	context_object->mpeg2_quantization_uploaded = true;
 
-	status = SunxiCedrusSyncSurface(context, context_object->render_surface_id);
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Takes a request from the pool, waiting for the oldest one in flight to
+ * complete when all of them are. This must be called with the driver mutex
+ * held.
+ */
+static int picture_acquire_request(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object)
+{
+	VAStatus status;
+	int request_fd;
+
+	request_fd = context_acquire_request(context_object);
+	if (request_fd >= 0)
+		return request_fd;
+
+	status = surface_sync_oldest(driver_data, context_object);
 	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	return context_acquire_request(context_object);
+}
+
+static void picture_release_request(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object, int request_fd)
+{
+	int rc;
+
+	/* Give the request back to the pool, without the objects bound to it. */
+	rc = media_request_reinit(request_fd);
+	if (rc < 0)
+		context_renew_request(driver_data, context_object, request_fd);
+	else
+		context_release_request(context_object, request_fd);
+}
+
+/*
+ * Submits the picture rendered to the surface with a request from the pool.
+ * This must be called with the driver mutex held.
+ */
+VAStatus picture_submit(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object)
+{
+	VASurfaceID surface_id = surface_object->base.id;
+	int request_fd = -1;
+	VAStatus status;
+	int position;
+	int rc;
+
+	/* All the slices were dropped, so there is nothing to decode. */
+	if (surface_object->slices_size == 0 && !surface_object->destination_queued) {
+		status = VA_STATUS_ERROR_DECODING_ERROR;
+		goto error;
+	}
+
+	/*
+	 * When all the requests of the pool are in flight, the oldest one has
+	 * to complete before the picture can be submitted.
+	 */
+	request_fd = picture_acquire_request(driver_data, context_object);
+	if (request_fd < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	surface_object->request_fd = request_fd;
+
+	/* The last slices were submitted ahead with slice submission. */
+	if (surface_object->source_data == NULL) {
+		status = surface_acquire_source(driver_data, context_object, surface_object);
+		if (status != VA_STATUS_SUCCESS)
+			goto error;
+	}
+
+	/*
+	 * The surface takes its place in the queue before the request is, so
+	 * that a queued request always has a surface to complete. The reactor
+	 * can only handle it once the mutex is released.
+	 */
+	rc = context_queue_surface(context_object, surface_id);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	surface_object->queued_timestamp = sunxi_cedrus_timestamp();
+
+	/*
+	 * The request is only queued here: waiting for its completion is
+	 * deferred to SyncSurface so that decoding overlaps with the
+	 * preparation of the next pictures.
+	 */
+	status = picture_queue_request(driver_data, context_object, surface_object, request_fd, false);
+	if (status != VA_STATUS_SUCCESS) {
+		position = context_surface_position(context_object, surface_id);
+		if (position >= 0)
+			context_remove_surface(context_object, position);
+
+		goto error;
+	}
+
+	return VA_STATUS_SUCCESS;
+
+error:
+	if (request_fd >= 0) {
+		picture_release_request(driver_data, context_object, request_fd);
+		surface_object->request_fd = -1;
+	}
+
+	/* The picture is dropped, so nothing is left to wait for. */
+	surface_release_source(context_object, surface_object);
+	surface_object->slices_size = 0;
+	surface_object->status = VASurfaceReady;
+
+	return status;
+}
+
+/*
+ * Submits the slices rendered to the surface so far with a request of their
+ * own, so that they are decoded while the next ones are being received. Their
+ * bitstream buffer is handed over to the context until completion. This must
+ * be called with the driver mutex held.
+ */
+VAStatus picture_submit_slice(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object)
+{
+	int request_fd;
+	VAStatus status;
+	int rc;
+
+	if (surface_object->source_data == NULL || surface_object->slices_size == 0)
+		return VA_STATUS_SUCCESS;
+
+	request_fd = picture_acquire_request(driver_data, context_object);
+	if (request_fd < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	status = picture_queue_request(driver_data, context_object, surface_object, request_fd, true);
+	if (status != VA_STATUS_SUCCESS) {
+		picture_release_request(driver_data, context_object, request_fd);
 		return status;
+	}
 
-	context_object->render_surface_id = VA_INVALID_ID;
+	/* There is room for all the requests of the pool. */
+	rc = context_hold_slice(context_object, surface_object->base.id, request_fd, surface_object->source_index);
+	if (rc < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	surface_object->source_index = 0;
+	surface_object->source_data = NULL;
+	surface_object->source_size = 0;
+	surface_object->slices_size = 0;
+	surface_object->slices_count = 0;
+	surface_object->mpeg2_header.slice_pos = 0;
 
 	return VA_STATUS_SUCCESS;
 }
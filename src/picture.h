@@ -29,6 +29,11 @@
 #include <va/va_backend.h>
 
 #include "object_heap.h"
+#include "sunxi_cedrus.h"
+#include "context.h"
+#include "surface.h"
+
+#define PICTURE_CONTROLS_MAX		2
 
 VAStatus SunxiCedrusBeginPicture(VADriverContextP context,
 	VAContextID context_id, VASurfaceID surface_id);
@@ -36,5 +41,11 @@ VAStatus SunxiCedrusRenderPicture(VADriverContextP context,
 	VAContextID context_id, VABufferID *buffers, int buffers_count);
 VAStatus SunxiCedrusEndPicture(VADriverContextP context,
 	VAContextID context_id);
+VAStatus picture_submit(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object);
+VAStatus picture_submit_slice(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object);
 
 #endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "sunxi_cedrus.h"
+#include "surface.h"
+#include "reactor.h"
+#include "utils.h"
+
+/*
+ * The reactor is a thread waiting for the completion of every media request
+ * in flight. Completed requests are handled right away: their buffers are
+ * dequeued and their surface is marked as displaying, so that syncing or
+ * querying a decoded surface does not involve the kernel.
+ *
+ * Events carry the surface id along with the submission they were watched
+ * for, so that a late event for a request that was since dropped does not
+ * complete another picture of the surface, or another surface with the same
+ * id.
+ */
+
+static void *reactor_loop(void *data)
+{
+	struct sunxi_cedrus_driver_data *driver_data =
+		(struct sunxi_cedrus_driver_data *) data;
+	struct epoll_event events[REACTOR_EVENTS_MAX];
+	struct object_surface *surface_object;
+	VASurfaceID surface_id;
+	uint32_t submission;
+	bool running = true;
+	int count;
+	int i;
+
+	while (running) {
+		count = epoll_wait(driver_data->epoll_fd, events, REACTOR_EVENTS_MAX, -1);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+
+			sunxi_cedrus_log("Unable to wait for media requests: %s\n", strerror(errno));
+			break;
+		}
+
+		pthread_mutex_lock(&driver_data->mutex);
+
+		for (i = 0; i < count; i++) {
+			surface_id = events[i].data.u64 & 0xffffffff;
+			submission = events[i].data.u64 >> 32;
+
+			/* The event file descriptor is used to stop the thread. */
+			if (surface_id == VA_INVALID_ID) {
+				running = false;
+				continue;
+			}
+
+			surface_object = SURFACE(surface_id);
+			if (surface_object == NULL || surface_object->request_fd < 0 || surface_object->submission != submission)
+				continue;
+
+			surface_complete_queued(driver_data, surface_object);
+		}
+
+		pthread_cond_broadcast(&driver_data->cond);
+		pthread_mutex_unlock(&driver_data->mutex);
+	}
+
+	return NULL;
+}
+
+int reactor_start(struct sunxi_cedrus_driver_data *driver_data)
+{
+	struct epoll_event event;
+	int rc;
+
+	driver_data->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (driver_data->epoll_fd < 0) {
+		sunxi_cedrus_log("Unable to create epoll instance: %s\n", strerror(errno));
+		goto error;
+	}
+
+	driver_data->event_fd = eventfd(0, EFD_CLOEXEC);
+	if (driver_data->event_fd < 0) {
+		sunxi_cedrus_log("Unable to create event file descriptor: %s\n", strerror(errno));
+		goto error;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = VA_INVALID_ID;
+
+	rc = epoll_ctl(driver_data->epoll_fd, EPOLL_CTL_ADD, driver_data->event_fd, &event);
+	if (rc < 0) {
+		sunxi_cedrus_log("Unable to watch event file descriptor: %s\n", strerror(errno));
+		goto error;
+	}
+
+	rc = pthread_create(&driver_data->reactor_thread, NULL, reactor_loop, driver_data);
+	if (rc != 0) {
+		sunxi_cedrus_log("Unable to create reactor thread: %s\n", strerror(rc));
+		goto error;
+	}
+
+	return 0;
+
+error:
+	if (driver_data->event_fd >= 0) {
+		close(driver_data->event_fd);
+		driver_data->event_fd = -1;
+	}
+
+	if (driver_data->epoll_fd >= 0) {
+		close(driver_data->epoll_fd);
+		driver_data->epoll_fd = -1;
+	}
+
+	return -1;
+}
+
+void reactor_stop(struct sunxi_cedrus_driver_data *driver_data)
+{
+	uint64_t value = 1;
+	ssize_t length;
+
+	if (driver_data->event_fd < 0)
+		return;
+
+	length = write(driver_data->event_fd, &value, sizeof(value));
+	if (length == sizeof(value))
+		pthread_join(driver_data->reactor_thread, NULL);
+	else
+		sunxi_cedrus_log("Unable to stop reactor thread: %s\n", strerror(errno));
+
+	close(driver_data->event_fd);
+	driver_data->event_fd = -1;
+
+	close(driver_data->epoll_fd);
+	driver_data->epoll_fd = -1;
+}
+
+int reactor_watch_request(struct sunxi_cedrus_driver_data *driver_data,
+	int request_fd, struct object_surface *surface_object)
+{
+	struct epoll_event event;
+	int rc;
+
+	surface_object->submission = ++driver_data->reactor_submission;
+
+	/* Request completion is signaled as an exceptional condition. */
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLPRI;
+	event.data.u64 = (uint64_t) surface_object->submission << 32 | surface_object->base.id;
+
+	rc = epoll_ctl(driver_data->epoll_fd, EPOLL_CTL_ADD, request_fd, &event);
+	if (rc < 0) {
+		sunxi_cedrus_log("Unable to watch media request: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int reactor_unwatch_request(struct sunxi_cedrus_driver_data *driver_data,
+	int request_fd)
+{
+	int rc;
+
+	rc = epoll_ctl(driver_data->epoll_fd, EPOLL_CTL_DEL, request_fd, NULL);
+	if (rc < 0) {
+		sunxi_cedrus_log("Unable to unwatch media request: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _REACTOR_H_
+#define _REACTOR_H_
+
+#include <va/va_backend.h>
+
+#include "sunxi_cedrus.h"
+
+#define REACTOR_EVENTS_MAX					8
+
+struct object_surface;
+
+int reactor_start(struct sunxi_cedrus_driver_data *driver_data);
+void reactor_stop(struct sunxi_cedrus_driver_data *driver_data);
+int reactor_watch_request(struct sunxi_cedrus_driver_data *driver_data,
+	int request_fd, struct object_surface *surface_object);
+int reactor_unwatch_request(struct sunxi_cedrus_driver_data *driver_data,
+	int request_fd);
+
+#endif
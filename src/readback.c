@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sunxi_cedrus.h"
+#include "surface.h"
+#include "image.h"
+#include "readback.h"
+#include "utils.h"
+
+/*
+ * Decoded surfaces are detiled to a linear NV12 copy attached to the surface,
+ * which images derived from the surface hand out. The copy is tagged with the
+ * decode generation of the surface and reused until the surface is rendered
+ * again.
+ *
+ * With background readback, a dedicated thread makes the copy as soon as the
+ * request of the surface completes, while the next picture is being decoded.
+ */
+
+static void *readback_loop(void *data)
+{
+	struct sunxi_cedrus_driver_data *driver_data =
+		(struct sunxi_cedrus_driver_data *) data;
+	struct object_surface *surface_object;
+	VASurfaceID surface_id;
+
+	pthread_mutex_lock(&driver_data->mutex);
+
+	while (!driver_data->readback_stopping) {
+		if (driver_data->readback_count == 0) {
+			pthread_cond_wait(&driver_data->readback_cond, &driver_data->mutex);
+			continue;
+		}
+
+		surface_id = driver_data->readback_queue[driver_data->readback_first];
+		driver_data->readback_first = (driver_data->readback_first + 1) % SUNXI_CEDRUS_READBACK_QUEUE_SIZE;
+		driver_data->readback_count--;
+
+		/* The surface might have been destroyed or rendered again. */
+		surface_object = SURFACE(surface_id);
+		if (surface_object == NULL || !surface_object->readback_queued)
+			continue;
+
+		surface_object->readback_queued = false;
+		readback_surface(driver_data, surface_object);
+
+		pthread_cond_broadcast(&driver_data->cond);
+	}
+
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return NULL;
+}
+
+int readback_start(struct sunxi_cedrus_driver_data *driver_data)
+{
+	char *readback_value;
+	char *stats_value;
+	int rc;
+
+	driver_data->readback = false;
+	driver_data->readback_first = 0;
+	driver_data->readback_count = 0;
+	driver_data->readback_stopping = false;
+	driver_data->readback_hits = 0;
+	driver_data->readback_misses = 0;
+
+	stats_value = getenv("LIBVA_CEDRUS_READBACK_STATS");
+	driver_data->readback_stats = stats_value != NULL && strtol(stats_value, NULL, 10) != 0;
+
+	readback_value = getenv("LIBVA_CEDRUS_ASYNC_READBACK");
+	if (readback_value == NULL || strtol(readback_value, NULL, 10) == 0)
+		return 0;
+
+	pthread_cond_init(&driver_data->readback_cond, NULL);
+
+	rc = pthread_create(&driver_data->readback_thread, NULL, readback_loop, driver_data);
+	if (rc != 0) {
+		sunxi_cedrus_log("Unable to create readback thread: %s\n", strerror(rc));
+		pthread_cond_destroy(&driver_data->readback_cond);
+		return -1;
+	}
+
+	driver_data->readback = true;
+
+	return 0;
+}
+
+void readback_stop(struct sunxi_cedrus_driver_data *driver_data)
+{
+	if (driver_data->readback_stats)
+		sunxi_cedrus_log("Derived images: %lu from cache, %lu detiled\n", driver_data->readback_hits, driver_data->readback_misses);
+
+	if (!driver_data->readback)
+		return;
+
+	pthread_mutex_lock(&driver_data->mutex);
+	driver_data->readback_stopping = true;
+	pthread_cond_signal(&driver_data->readback_cond);
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	pthread_join(driver_data->readback_thread, NULL);
+	pthread_cond_destroy(&driver_data->readback_cond);
+
+	driver_data->readback = false;
+}
+
+/* The following functions must be called with the driver mutex held. */
+
+void readback_queue_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	unsigned int index;
+
+	if (!driver_data->readback || surface_object->readback_queued)
+		return;
+
+	/* Linear pictures are handed out as they are. */
+	if (driver_data->capture_format != V4L2_PIX_FMT_MB32_NV12)
+		return;
+
+	/* Images are detiled on demand when the thread is lagging behind. */
+	if (driver_data->readback_count == SUNXI_CEDRUS_READBACK_QUEUE_SIZE)
+		return;
+
+	index = (driver_data->readback_first + driver_data->readback_count) % SUNXI_CEDRUS_READBACK_QUEUE_SIZE;
+	driver_data->readback_queue[index] = surface_object->base.id;
+	driver_data->readback_count++;
+
+	surface_object->readback_queued = true;
+
+	pthread_cond_signal(&driver_data->readback_cond);
+}
+
+void readback_wait_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	while (surface_object->readback_queued || surface_object->readback_busy)
+		pthread_cond_wait(&driver_data->cond, &driver_data->mutex);
+}
+
+/* Returns whether the linear copy of the surface is up to date. */
+bool readback_cached(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	return surface_object->readback_data != NULL && surface_object->readback_generation == surface_object->generation && surface_object->readback_rotation == driver_data->rotation;
+}
+
+/*
+ * Detiles the surface to its linear copy. The mutex is released meanwhile,
+ * but the surface cannot be rendered to until it is done.
+ */
+int readback_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	unsigned int rotation = driver_data->rotation;
+	VAImage layout;
+
+	/* The copy is in the format and orientation of derived images. */
+	if (rotation == VA_ROTATION_90 || rotation == VA_ROTATION_270)
+		image_layout(driver_data->derive_fourcc, surface_object->height, surface_object->width, &layout);
+	else
+		image_layout(driver_data->derive_fourcc, surface_object->width, surface_object->height, &layout);
+
+	/* Derived images rely on the layout of the copy they wrap. */
+	if (surface_object->readback_data != NULL && surface_object->readback_rotation != rotation && image_wraps_readback(driver_data, surface_object->readback_data)) {
+		sunxi_cedrus_log("Unable to rotate readback buffer used by derived images\n");
+		return -1;
+	}
+
+	/* Rotating by a quarter turn changes the lines alignment and size. */
+	if (surface_object->readback_data != NULL && surface_object->readback_size < layout.data_size) {
+		buffer_pool_free_image(&driver_data->buffer_pool, surface_object->readback_data, surface_object->readback_size);
+		surface_object->readback_data = NULL;
+	}
+
+	if (surface_object->readback_data == NULL) {
+		surface_object->readback_data = buffer_pool_alloc_image(&driver_data->buffer_pool, layout.data_size);
+		if (surface_object->readback_data == NULL) {
+			sunxi_cedrus_log("Unable to allocate readback buffer\n");
+			return -1;
+		}
+
+		surface_object->readback_size = layout.data_size;
+	}
+
+	surface_object->readback_busy = true;
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	image_copy(driver_data, surface_object, 0, 0, surface_object->width, surface_object->height, 0, rotation, surface_object->readback_data, &layout);
+
+	pthread_mutex_lock(&driver_data->mutex);
+	surface_object->readback_busy = false;
+	surface_object->readback_generation = surface_object->generation;
+	surface_object->readback_rotation = rotation;
+
+	pthread_cond_broadcast(&driver_data->cond);
+
+	return 0;
+}
+
+/* Keeps the capture buffers from being read while they are decoded to. */
+void readback_cancel_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	while (surface_object->readback_busy)
+		pthread_cond_wait(&driver_data->cond, &driver_data->mutex);
+
+	surface_object->readback_queued = false;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef _READBACK_H_
+#define _READBACK_H_
+
+#include "sunxi_cedrus.h"
+#include "surface.h"
+
+int readback_start(struct sunxi_cedrus_driver_data *driver_data);
+void readback_stop(struct sunxi_cedrus_driver_data *driver_data);
+void readback_queue_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
+void readback_wait_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
+bool readback_cached(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
+int readback_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
+void readback_cancel_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
+
+#endif
@@ -30,6 +30,10 @@
 #include "subpicture.h"
 #include "surface.h"
 #include "config.h"
+#include "reactor.h"
+#include "v4l2.h"
+#include "readback.h"
+#include "tiled_yuv.h"
 
 #include "autoconfig.h"
 
@@ -46,6 +50,7 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <sys/ioctl.h>
 
@@ -60,11 +65,18 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 	struct sunxi_cedrus_driver_data *driver_data;
 	struct VADriverVTable *vtable = context->vtable;
 	struct v4l2_capability capability;
+	pthread_condattr_t condattr;
 	VAStatus status;
 	int video_fd = -1;
 	int media_fd = -1;
 	char *video_path;
 	char *media_path;
+	char *derive_format;
+	char *rgb_matrix;
+	char *rgb_range;
+	char *mirror;
+	bool bt709 = false;
+	bool full_range = false;
 	int rc;
 
 	context->version_major = VA_MAJOR_VERSION;
@@ -133,13 +145,17 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 	object_heap_init(&driver_data->buffer_heap, sizeof(struct object_buffer), BUFFER_ID_OFFSET);
 	object_heap_init(&driver_data->image_heap, sizeof(struct object_image), IMAGE_ID_OFFSET);
 
+	tiled_yuv_init();
+
 	video_path = getenv("LIBVA_CEDRUS_VIDEO_PATH");
 	if (video_path == NULL)
 		video_path = "/dev/video0";
 
 	video_fd = open(video_path, O_RDWR | O_NONBLOCK);
-	if (video_fd < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	if (video_fd < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
 
 	rc = ioctl(video_fd, VIDIOC_QUERYCAP, &capability);
 	if (rc < 0 || !(capability.capabilities & V4L2_CAP_VIDEO_M2M_MPLANE)) {
@@ -153,17 +169,110 @@ VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context)
 		media_path = "/dev/media0";
 
 	media_fd = open(media_path, O_RDWR | O_NONBLOCK);
-	if (media_fd < 0)
-		return VA_STATUS_ERROR_OPERATION_FAILED;
+	if (media_fd < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
 
 	driver_data->video_fd = video_fd;
 	driver_data->media_fd = media_fd;
 
+	/* Pools start their threads once the device is known to be usable. */
+	rc = buffer_pool_init(&driver_data->buffer_pool);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		goto error;
+	}
+
+	rc = detile_pool_init(&driver_data->detile_pool);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+		goto error;
+	}
+
+	/* Linear pictures can be read back without detiling them. */
+	if (v4l2_find_format(video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_PIX_FMT_NV12M))
+		driver_data->capture_format = V4L2_PIX_FMT_NV12M;
+	else
+		driver_data->capture_format = V4L2_PIX_FMT_MB32_NV12;
+
+	/* Derived images are NV12 unless another supported format is asked. */
+	driver_data->derive_fourcc = VA_FOURCC_NV12;
+
+	derive_format = getenv("LIBVA_CEDRUS_DERIVE_FORMAT");
+	if (derive_format != NULL) {
+		if (strlen(derive_format) == 4 && image_fourcc_supported(VA_FOURCC(derive_format[0], derive_format[1], derive_format[2], derive_format[3])))
+			driver_data->derive_fourcc = VA_FOURCC(derive_format[0], derive_format[1], derive_format[2], derive_format[3]);
+		else
+			sunxi_cedrus_log("Unsupported derived image format %s\n", derive_format);
+	}
+
+	/* RGB images use BT.601 limited range unless told otherwise. */
+	rgb_matrix = getenv("LIBVA_CEDRUS_RGB_MATRIX");
+	if (rgb_matrix != NULL) {
+		if (strcmp(rgb_matrix, "709") == 0)
+			bt709 = true;
+		else if (strcmp(rgb_matrix, "601") != 0)
+			sunxi_cedrus_log("Unsupported RGB matrix %s\n", rgb_matrix);
+	}
+
+	rgb_range = getenv("LIBVA_CEDRUS_RGB_RANGE");
+	if (rgb_range != NULL) {
+		if (strcmp(rgb_range, "full") == 0)
+			full_range = true;
+		else if (strcmp(rgb_range, "limited") != 0)
+			sunxi_cedrus_log("Unsupported RGB range %s\n", rgb_range);
+	}
+
+	tiled_yuv_rgb_init(&driver_data->rgb_conversion, bt709, full_range, false);
+	tiled_yuv_rgb_init(&driver_data->bgr_conversion, bt709, full_range, true);
+
+	/* Rotation is a display attribute, libva has no such thing for mirroring. */
+	driver_data->rotation = VA_ROTATION_NONE;
+	driver_data->mirror = 0;
+
+	mirror = getenv("LIBVA_CEDRUS_MIRROR");
+	if (mirror != NULL) {
+		if (strcmp(mirror, "horizontal") == 0)
+			driver_data->mirror = SUNXI_CEDRUS_MIRROR_HORIZONTAL;
+		else if (strcmp(mirror, "vertical") == 0)
+			driver_data->mirror = SUNXI_CEDRUS_MIRROR_VERTICAL;
+		else
+			sunxi_cedrus_log("Unsupported mirroring %s\n", mirror);
+	}
+
+	driver_data->epoll_fd = -1;
+	driver_data->event_fd = -1;
+
+	pthread_mutex_init(&driver_data->mutex, NULL);
+
+	/* Timeouts are based on monotonic timestamps. */
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&driver_data->cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+
+	rc = reactor_start(driver_data);
+	if (rc < 0) {
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
+	rc = readback_start(driver_data);
+	if (rc < 0) {
+		/* The reactor thread polls the devices that are about to be closed. */
+		reactor_stop(driver_data);
+		status = VA_STATUS_ERROR_OPERATION_FAILED;
+		goto error;
+	}
+
 	status = VA_STATUS_SUCCESS;
 	goto complete;
 
 error:
-	status = VA_STATUS_ERROR_OPERATION_FAILED;
+	/* Pools that were not set up yet are still zeroed, which is harmless. */
+	detile_pool_destroy(&driver_data->detile_pool);
+	buffer_pool_destroy(&driver_data->buffer_pool);
 
 	if (video_fd >= 0)
 		close(video_fd);
@@ -186,8 +295,15 @@ VAStatus SunxiCedrusTerminate(VADriverContextP context)
 	struct object_config *config_object;
 	object_heap_iterator iterator;
 
-	close(driver_data->video_fd);
-	close(driver_data->media_fd);
+	/*
+	 * Contexts are drained first, while the reactor still completes their
+	 * requests and the video device is open.
+	 */
+	context_object = (struct object_context *) object_heap_first(&driver_data->context_heap, &iterator);
+	while (context_object != NULL) {
+		SunxiCedrusDestroyContext(context, (VAContextID) context_object->base.id);
+		context_object = (struct object_context *) object_heap_next(&driver_data->context_heap, &iterator);
+	}
 
 	/* Cleanup leftover buffers. */
 
@@ -197,31 +313,33 @@ VAStatus SunxiCedrusTerminate(VADriverContextP context)
 		image_object = (struct object_image *) object_heap_next(&driver_data->image_heap, &iterator);
 	}
 
-	object_heap_destroy(&driver_data->image_heap);
-
 	buffer_object = (struct object_buffer *) object_heap_first(&driver_data->buffer_heap, &iterator);
 	while (buffer_object != NULL) {
 		SunxiCedrusDestroyBuffer(context, (VABufferID) buffer_object->base.id);
 		buffer_object = (struct object_buffer *) object_heap_next(&driver_data->buffer_heap, &iterator);
 	}
 
-	object_heap_destroy(&driver_data->buffer_heap);
-
 	surface_object = (struct object_surface *) object_heap_first(&driver_data->surface_heap, &iterator);
 	while (surface_object != NULL) {
 		SunxiCedrusDestroySurfaces(context, (VASurfaceID *) &surface_object->base.id, 1);
 		surface_object = (struct object_surface *) object_heap_next(&driver_data->surface_heap, &iterator);
 	}
 
+	/* The threads look objects up until they are stopped. */
+	reactor_stop(driver_data);
+	readback_stop(driver_data);
+	detile_pool_destroy(&driver_data->detile_pool);
+
+	object_heap_destroy(&driver_data->context_heap);
+	object_heap_destroy(&driver_data->image_heap);
+	object_heap_destroy(&driver_data->buffer_heap);
 	object_heap_destroy(&driver_data->surface_heap);
 
-	context_object = (struct object_context *) object_heap_first(&driver_data->context_heap, &iterator);
-	while (context_object != NULL) {
-		SunxiCedrusDestroyContext(context, (VAContextID) context_object->base.id);
-		context_object = (struct object_context *) object_heap_next(&driver_data->context_heap, &iterator);
-	}
+	/* Surfaces give their readback buffers back to the pool. */
+	buffer_pool_destroy(&driver_data->buffer_pool);
 
-	object_heap_destroy(&driver_data->context_heap);
+	close(driver_data->video_fd);
+	close(driver_data->media_fd);
 
 	config_object = (struct object_config *) object_heap_first(&driver_data->config_heap, &iterator);
 	while (config_object != NULL) {
@@ -231,6 +349,9 @@ VAStatus SunxiCedrusTerminate(VADriverContextP context)
 
 	object_heap_destroy(&driver_data->config_heap);
 
+	pthread_cond_destroy(&driver_data->cond);
+	pthread_mutex_destroy(&driver_data->mutex);
+
 	free(context->pDriverData);
 	context->pDriverData = NULL;
 
@@ -26,8 +26,14 @@
 #ifndef _SUNXI_CEDRUS_H_
 #define _SUNXI_CEDRUS_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
 #include <va/va.h>
 #include "object_heap.h"
+#include "buffer_pool.h"
+#include "detile.h"
 #include "context.h"
 
 #include <linux/videodev2.h>
@@ -40,6 +46,10 @@
 #define SUNXI_CEDRUS_MAX_IMAGE_FORMATS		10
 #define SUNXI_CEDRUS_MAX_SUBPIC_FORMATS		4
 #define SUNXI_CEDRUS_MAX_DISPLAY_ATTRIBUTES	4
+#define SUNXI_CEDRUS_READBACK_QUEUE_SIZE	32
+
+#define SUNXI_CEDRUS_MIRROR_HORIZONTAL		(1 << 0)
+#define SUNXI_CEDRUS_MIRROR_VERTICAL		(1 << 1)
 
 struct sunxi_cedrus_driver_data {
 	struct object_heap config_heap;
@@ -47,8 +57,44 @@ struct sunxi_cedrus_driver_data {
 	struct object_heap surface_heap;
 	struct object_heap buffer_heap;
 	struct object_heap image_heap;
+	struct buffer_pool buffer_pool;
+	struct detile_pool detile_pool;
 	int video_fd;
 	int media_fd;
+
+	/* Either tiled or, when the hardware can write it, linear NV12. */
+	unsigned int capture_format;
+	unsigned int derive_fourcc;
+
+	/* Conversions to RGB images, in either components order. */
+	struct tiled_yuv_rgb rgb_conversion;
+	struct tiled_yuv_rgb bgr_conversion;
+
+	/* Images are mirrored first and then rotated, as VA_ROTATION_*. */
+	unsigned int rotation;
+	unsigned int mirror;
+
+	/* Protects the state of surfaces and contexts shared with the reactor. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t reactor_thread;
+	int epoll_fd;
+	int event_fd;
+	uint32_t reactor_submission;
+
+	/* Background readback of decoded surfaces, when enabled. */
+	bool readback;
+	bool readback_stopping;
+	pthread_t readback_thread;
+	pthread_cond_t readback_cond;
+	VASurfaceID readback_queue[SUNXI_CEDRUS_READBACK_QUEUE_SIZE];
+	unsigned int readback_first;
+	unsigned int readback_count;
+
+	/* Derived images using the cached linear copy of surfaces or not. */
+	unsigned long readback_hits;
+	unsigned long readback_misses;
+	bool readback_stats;
 };
 
 VAStatus VA_DRIVER_INIT_FUNC(VADriverContextP context);
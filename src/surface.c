@@ -25,12 +25,16 @@
 
 #include "sunxi_cedrus.h"
 #include "surface.h"
+#include "context.h"
+#include "image.h"
 
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -41,6 +45,8 @@
 
 #include "v4l2.h"
 #include "media.h"
+#include "reactor.h"
+#include "readback.h"
 #include "utils.h"
 
 VAStatus SunxiCedrusCreateSurfaces(VADriverContextP context, int width,
@@ -52,6 +58,9 @@ VAStatus SunxiCedrusCreateSurfaces(VADriverContextP context, int width,
 	unsigned int length[2];
 	unsigned int offset[2];
 	void *destination_data[2];
+	unsigned int pitch;
+	unsigned int size;
+	void *area;
 	VASurfaceID id;
 	unsigned int i, j;
 	int rc;
@@ -59,11 +68,15 @@ VAStatus SunxiCedrusCreateSurfaces(VADriverContextP context, int width,
 	if (format != VA_RT_FORMAT_YUV420)
 		return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
 
-	rc = v4l2_set_format(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_PIX_FMT_MB32_NV12, width, height);
+	rc = v4l2_set_format(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, driver_data->capture_format, width, height, 0);
 	if (rc < 0)
 		return VA_STATUS_ERROR_OPERATION_FAILED;
 
-	rc = v4l2_create_buffers(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, surfaces_count);
+	rc = v4l2_get_format_pitch(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, &pitch);
+	if (rc < 0)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	rc = v4l2_create_buffers(driver_data->video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, surfaces_count, 0, NULL);
 	if (rc < 0)
 		return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
@@ -77,15 +90,29 @@ VAStatus SunxiCedrusCreateSurfaces(VADriverContextP context, int width,
 		if (rc < 0)
 			return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
-		destination_data[0] = mmap(NULL, length[0], PROT_READ | PROT_WRITE, MAP_SHARED, driver_data->video_fd, offset[0]);
-		if (destination_data[0] == MAP_FAILED)
-			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+		/*
+		 * Linear planes are mapped next to each other in a reserved
+		 * area, so that images can be derived from them directly.
+		 */
+		if (driver_data->capture_format == V4L2_PIX_FMT_NV12M) {
+			size = (length[0] + sysconf(_SC_PAGESIZE) - 1) & ~(sysconf(_SC_PAGESIZE) - 1);
+
+			area = mmap(NULL, size + length[1], PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (area == MAP_FAILED)
+				return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+			destination_data[0] = mmap(area, length[0], PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, driver_data->video_fd, offset[0]);
+			destination_data[1] = mmap((unsigned char *) area + size, length[1], PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, driver_data->video_fd, offset[1]);
+		} else {
+			destination_data[0] = mmap(NULL, length[0], PROT_READ | PROT_WRITE, MAP_SHARED, driver_data->video_fd, offset[0]);
+			destination_data[1] = mmap(NULL, length[1], PROT_READ | PROT_WRITE, MAP_SHARED, driver_data->video_fd, offset[1]);
+		}
 
-		destination_data[1] = mmap(NULL, length[1], PROT_READ | PROT_WRITE, MAP_SHARED, driver_data->video_fd, offset[1]);
-		if (destination_data[1] == MAP_FAILED)
+		if (destination_data[0] == MAP_FAILED || destination_data[1] == MAP_FAILED)
 			return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
 		surface_object->status = VASurfaceReady;
+		surface_object->context_id = VA_INVALID_ID;
 		surface_object->width = width;
 		surface_object->height = height;
 		surface_object->source_index = 0;
@@ -98,9 +125,24 @@ VAStatus SunxiCedrusCreateSurfaces(VADriverContextP context, int width,
 			surface_object->destination_size[j] = length[j];
 		}
 
+		surface_object->destination_pitch = pitch;
+
 		memset(&surface_object->mpeg2_header, 0, sizeof(surface_object->mpeg2_header));
+		memset(&surface_object->mpeg2_quantization, 0, sizeof(surface_object->mpeg2_quantization));
 		surface_object->slices_size = 0;
+		surface_object->slices_count = 0;
+		surface_object->slices_pending_count = 0;
+		surface_object->destination_queued = false;
+		surface_object->readback_data = NULL;
+		surface_object->readback_size = 0;
+		surface_object->readback_generation = 0;
+		surface_object->readback_rotation = VA_ROTATION_NONE;
+		surface_object->readback_queued = false;
+		surface_object->readback_busy = false;
 		surface_object->request_fd = -1;
+		surface_object->submission = 0;
+		surface_object->sequence = 0;
+		surface_object->generation = 0;
 
 		surfaces_ids[i] = id;
 	}
@@ -108,12 +150,69 @@ VAStatus SunxiCedrusCreateSurfaces(VADriverContextP context, int width,
 	return VA_STATUS_SUCCESS;
 }
 
+/*
+ * Completes what is still in flight for the surface before it is destroyed,
+ * so that the hardware is done with its buffers and the context no longer
+ * waits for it. This must be called with the driver mutex held.
+ */
+static void surface_drain(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	struct object_context *context_object;
+	VASurfaceID surface_id = surface_object->base.id;
+	int position;
+
+	context_object = CONTEXT(surface_object->context_id);
+	if (context_object == NULL)
+		return;
+
+	if (surface_object->status == VASurfaceRendering && context_surface_queued(context_object, surface_id))
+		surface_sync(driver_data, surface_object);
+
+	/* A request that could not be completed is dropped with the surface. */
+	position = context_surface_position(context_object, surface_id);
+	if (position >= 0) {
+		context_remove_surface(context_object, position);
+
+		if (surface_object->request_fd >= 0) {
+			reactor_unwatch_request(driver_data, surface_object->request_fd);
+			context_renew_request(driver_data, context_object, surface_object->request_fd);
+			surface_object->request_fd = -1;
+		}
+
+		/*
+		 * Its bitstream buffer might still be queued, so it is not
+		 * handed out again.
+		 */
+		surface_object->source_data = NULL;
+	}
+
+	if (context_object->render_surface_id != surface_id)
+		return;
+
+	/*
+	 * Slices submitted ahead of the picture keep its capture buffer queued
+	 * until the last one, so the streams are restarted to get it back once
+	 * the pictures in flight are decoded.
+	 */
+	if (surface_object->destination_queued) {
+		while (context_object->queued_count > 0)
+			if (surface_sync_oldest(driver_data, context_object) != VA_STATUS_SUCCESS)
+				break;
+
+		context_recover(driver_data, context_object);
+	}
+
+	context_object->render_surface_id = VA_INVALID_ID;
+}
+
 VAStatus SunxiCedrusDestroySurfaces(VADriverContextP context,
 	VASurfaceID *surfaces_ids, int surfaces_count)
 {
 	struct sunxi_cedrus_driver_data *driver_data =
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_surface *surface_object;
+	struct object_context *context_object;
 	unsigned int i, j;
 
 	for (i = 0; i < surfaces_count; i++) {
@@ -121,11 +220,29 @@ VAStatus SunxiCedrusDestroySurfaces(VADriverContextP context,
 		if (surface_object == NULL)
 			return VA_STATUS_ERROR_INVALID_SURFACE;
 
-		if (surface_object->source_data != NULL && surface_object->source_size > 0)
-			munmap(surface_object->source_data, surface_object->source_size);
+		pthread_mutex_lock(&driver_data->mutex);
+		surface_drain(driver_data, surface_object);
+
+		/* The bitstream buffer belongs to the context. */
+		context_object = CONTEXT(surface_object->context_id);
+		if (context_object != NULL)
+			surface_release_source(context_object, surface_object);
+
+		readback_cancel_surface(driver_data, surface_object);
+
+		/* Derived images keep the copy, the last one destroyed frees it. */
+		if (surface_object->readback_data != NULL && image_wraps_readback(driver_data, surface_object->readback_data))
+			surface_object->readback_data = NULL;
+
+		/* The same goes for the capture planes they wrap. */
+		if (surface_object->destination_data[0] != NULL && image_wraps_destination(driver_data, surface_object->destination_data[0]))
+			for (j = 0; j < 2; j++)
+				surface_object->destination_data[j] = NULL;
+
+		pthread_mutex_unlock(&driver_data->mutex);
 
-		if (surface_object->request_fd >= 0)
-			close(surface_object->request_fd);
+		if (surface_object->readback_data != NULL)
+			buffer_pool_free_image(&driver_data->buffer_pool, surface_object->readback_data, surface_object->readback_size);
 
 		for (j = 0; j < 2; j++)
 			if (surface_object->destination_data[j] != NULL && surface_object->destination_size[j] > 0)
@@ -144,33 +261,244 @@ VAStatus SunxiCedrusSyncSurface(VADriverContextP context,
 		(struct sunxi_cedrus_driver_data *) context->pDriverData;
 	struct object_surface *surface_object;
 	VAStatus status;
-	int request_fd = -1;
-	int rc;
 
 	surface_object = SURFACE(surface_id);
-	if (surface_object == NULL) {
-		status = VA_STATUS_ERROR_INVALID_SURFACE;
-		goto error;
+	if (surface_object == NULL)
+		return VA_STATUS_ERROR_INVALID_SURFACE;
+
+	pthread_mutex_lock(&driver_data->mutex);
+	status = surface_sync(driver_data, surface_object);
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	return status;
+}
+
+/*
+ * Waits for the reactor to complete the request of the surface. This must be
+ * called with the driver mutex held.
+ */
+VAStatus surface_sync(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	struct object_context *context_object;
+	VASurfaceID surface_id = surface_object->base.id;
+	struct timespec timeout;
+	uint64_t timestamp;
+	int position;
+	int rc;
+
+	if (surface_object->status != VASurfaceRendering)
+		return VA_STATUS_SUCCESS;
+
+	context_object = CONTEXT(surface_object->context_id);
+	if (context_object == NULL)
+		return VA_STATUS_ERROR_INVALID_CONTEXT;
+
+	/* The picture was not submitted with EndPicture yet. */
+	if (!context_surface_queued(context_object, surface_id))
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	while ((position = context_surface_position(context_object, surface_id)) >= 0) {
+		/*
+		 * The requests queued before this one have to complete first,
+		 * so each of them adds up to the time allowed.
+		 */
+		timestamp = sunxi_cedrus_timestamp() + (uint64_t) (position + 1) * context_object->timeout;
+		timeout.tv_sec = timestamp / 1000000;
+		timeout.tv_nsec = (timestamp % 1000000) * 1000;
+
+		rc = 0;
+		while (rc != ETIMEDOUT && context_surface_position(context_object, surface_id) == position)
+			rc = pthread_cond_timedwait(&driver_data->cond, &driver_data->mutex, &timeout);
+
+		if (rc != ETIMEDOUT || context_surface_position(context_object, surface_id) != position)
+			continue;
+
+		sunxi_cedrus_log("Timeout when waiting for surface %d\n", surface_id);
+
+		rc = context_recover(driver_data, context_object);
+		pthread_cond_broadcast(&driver_data->cond);
+
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+	}
+
+	if (surface_object->status != VASurfaceDisplaying)
+		return VA_STATUS_ERROR_OPERATION_FAILED;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Completes the request of the surface, after the ones queued before it since
+ * buffers are dequeued in submission order. This must be called with the
+ * driver mutex held.
+ */
+VAStatus surface_complete_queued(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	struct object_surface *queued_object;
+	struct object_context *context_object;
+	VASurfaceID surface_id = surface_object->base.id;
+	VASurfaceID queued_id;
+	VAStatus status;
+
+	context_object = CONTEXT(surface_object->context_id);
+	if (context_object == NULL)
+		return VA_STATUS_ERROR_INVALID_CONTEXT;
+
+	/* The request might already be completed along with a later one. */
+	if (!context_surface_queued(context_object, surface_id))
+		return VA_STATUS_SUCCESS;
+
+	do {
+		queued_id = context_dequeue_surface(context_object);
+
+		queued_object = SURFACE(queued_id);
+		if (queued_object == NULL)
+			return VA_STATUS_ERROR_INVALID_SURFACE;
+
+		status = surface_complete_request(driver_data, queued_object);
+	} while (queued_id != surface_id);
+
+	return status;
+}
+
+/*
+ * Waits for the oldest picture in flight to complete, or for the oldest slice
+ * submitted ahead of the picture being rendered when there is none, so that
+ * its request and bitstream buffer become available. This must be called with
+ * the driver mutex held.
+ */
+VAStatus surface_sync_oldest(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object)
+{
+	struct object_surface *queued_object;
+	int rc;
+
+	if (context_object->queued_count > 0) {
+		queued_object = SURFACE(context_object->queued_ids[context_object->queued_first]);
+		if (queued_object == NULL)
+			return VA_STATUS_ERROR_INVALID_SURFACE;
+
+		return surface_sync(driver_data, queued_object);
 	}
 
-	if (surface_object->status != VASurfaceRendering) {
-		status = VA_STATUS_SUCCESS;
-		goto complete;
+	if (context_object->slices_count > 0) {
+		rc = context_complete_slice(driver_data, context_object);
+		if (rc < 0)
+			return VA_STATUS_ERROR_OPERATION_FAILED;
+
+		return VA_STATUS_SUCCESS;
 	}
 
+	return VA_STATUS_ERROR_OPERATION_FAILED;
+}
+
+/*
+ * Hands out a bitstream buffer from the context to the surface. When none is
+ * available, the oldest picture in flight has to complete first. This must be
+ * called with the driver mutex held.
+ */
+VAStatus surface_acquire_source(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object)
+{
+	int index;
+
+	index = context_acquire_source(context_object);
+	if (index < 0) {
+		surface_sync_oldest(driver_data, context_object);
+
+		index = context_acquire_source(context_object);
+		if (index < 0)
+			return VA_STATUS_ERROR_ALLOCATION_FAILED;
+	}
+
+	surface_bind_source(context_object, surface_object, index);
+
+	return VA_STATUS_SUCCESS;
+}
+
+/*
+ * Replaces the bitstream buffer of the surface with a larger one, keeping the
+ * slice data it already holds. This must be called with the driver mutex held.
+ */
+VAStatus surface_grow_source(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object, unsigned int size)
+{
+	int index;
+
+	if (size > CONTEXT_SOURCE_SIZE_MAX)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+	/* Growing geometrically keeps the number of stale buffers low. */
+	if (size < surface_object->source_size * 2)
+		size = surface_object->source_size * 2;
+
+	if (size > CONTEXT_SOURCE_SIZE_MAX)
+		size = CONTEXT_SOURCE_SIZE_MAX;
+
+	index = context_grow_source(driver_data, context_object, size);
+	if (index < 0)
+		return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+	if (surface_object->source_data != NULL)
+		memcpy(context_object->sources_data[index], surface_object->source_data, surface_object->slices_size);
+
+	surface_bind_source(context_object, surface_object, index);
+
+	return VA_STATUS_SUCCESS;
+}
+
+void surface_bind_source(struct object_context *context_object,
+	struct object_surface *surface_object, unsigned int index)
+{
+	surface_object->source_index = index;
+	surface_object->source_data = context_object->sources_data[index];
+	surface_object->source_size = context_object->sources_sizes[index];
+}
+
+void surface_release_source(struct object_context *context_object,
+	struct object_surface *surface_object)
+{
+	if (surface_object->source_data == NULL)
+		return;
+
+	context_release_source(context_object, surface_object->source_index);
+
+	surface_object->source_index = 0;
+	surface_object->source_data = NULL;
+	surface_object->source_size = 0;
+}
+
+VAStatus surface_complete_request(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+	struct object_context *context_object;
+	VASurfaceID surface_id = surface_object->base.id;
+	VAStatus status;
+	int request_fd;
+	int rc;
+
+	context_object = CONTEXT(surface_object->context_id);
+	if (context_object == NULL)
+		return VA_STATUS_ERROR_INVALID_CONTEXT;
+
+	/* The slices submitted ahead of the picture were decoded first. */
+	while (context_object->slices_count > 0 && context_object->slices_surfaces_ids[context_object->slices_first] == surface_id)
+		context_complete_slice(driver_data, context_object);
+
 	request_fd = surface_object->request_fd;
 	if (request_fd < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
 	}
 
-	rc = media_request_queue(request_fd);
-	if (rc < 0) {
-		status = VA_STATUS_ERROR_OPERATION_FAILED;
-		goto error;
-	}
+	reactor_unwatch_request(driver_data, request_fd);
 
-	rc = media_request_wait_completion(request_fd);
+	rc = media_request_wait_completion(request_fd, context_object->timeout);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
@@ -188,23 +516,36 @@ VAStatus SunxiCedrusSyncSurface(VADriverContextP context,
 		goto error;
 	}
 
-	rc = v4l2_dequeue_buffer(driver_data->video_fd, request_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, surface_object->destination_index);
+	/* The capture buffer is not part of the requests with slice submission. */
+	rc = v4l2_dequeue_buffer(driver_data->video_fd, context_object->slice_submission ? -1 : request_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, surface_object->destination_index);
 	if (rc < 0) {
 		status = VA_STATUS_ERROR_OPERATION_FAILED;
 		goto error;
 	}
 
+	context_release_request(context_object, request_fd);
+	surface_object->request_fd = -1;
+	surface_object->destination_queued = false;
+
+	surface_release_source(context_object, surface_object);
+	context_record_decode_time(context_object, surface_object->queued_timestamp);
+
 	surface_object->status = VASurfaceDisplaying;
 
+	readback_queue_surface(driver_data, surface_object);
+
 	status = VA_STATUS_SUCCESS;
 	goto complete;
 
 error:
 	if (request_fd >= 0) {
-		close(request_fd);
+		context_renew_request(driver_data, context_object, request_fd);
 		surface_object->request_fd = -1;
 	}
 
+	surface_release_source(context_object, surface_object);
+	surface_object->destination_queued = false;
+
 complete:
 	return status;
 }
@@ -220,7 +561,10 @@ VAStatus SunxiCedrusQuerySurfaceStatus(VADriverContextP context,
 	if (surface_object == NULL)
 		return VA_STATUS_ERROR_INVALID_SURFACE;
 
+	/* The status is kept up to date by the reactor. */
+	pthread_mutex_lock(&driver_data->mutex);
 	*status = surface_object->status;
+	pthread_mutex_unlock(&driver_data->mutex);
 
 	return VA_STATUS_SUCCESS;
 }
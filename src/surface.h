@@ -26,17 +26,27 @@
 #ifndef _SURFACE_H_
 #define _SURFACE_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <va/va_backend.h>
 
 #include "object_heap.h"
+#include "sunxi_cedrus.h"
+#include "context.h"
 
 #define SURFACE(id) ((struct object_surface *) object_heap_lookup(&driver_data->surface_heap, id))
 #define SURFACE_ID_OFFSET		0x04000000
 
+/* Slices described by a slice parameter buffer, checked against their data. */
+#define SURFACE_SLICES_PENDING_MAX	512
+
+
 struct object_surface {
 	struct object_base base;
 
 	VAStatus status;
+	VAContextID context_id;
 	int width;
 	int height;
 
@@ -47,11 +57,30 @@ struct object_surface {
 	unsigned int destination_index;
 	void *destination_data[2];
 	unsigned int destination_size[2];
+	unsigned int destination_pitch;
+	bool destination_queued;
 
 	struct v4l2_ctrl_mpeg2_frame_hdr mpeg2_header;
+	struct v4l2_ctrl_mpeg2_quantization mpeg2_quantization;
 	unsigned int slices_size;
+	unsigned int slices_count;
+	unsigned int slices_pending_count;
+	unsigned int slices_pending_offsets[SURFACE_SLICES_PENDING_MAX];
+	unsigned int slices_pending_sizes[SURFACE_SLICES_PENDING_MAX];
+
+	/* Linear copy of the picture, for the given decode generation. */
+	void *readback_data;
+	unsigned int readback_size;
+	uint64_t readback_generation;
+	unsigned int readback_rotation;
+	bool readback_queued;
+	bool readback_busy;
 
 	int request_fd;
+	uint32_t submission;
+	uint64_t sequence;
+	uint64_t generation;
+	uint64_t queued_timestamp;
 };
 
 VAStatus SunxiCedrusCreateSurfaces(VADriverContextP context, int width,
@@ -60,6 +89,24 @@ VAStatus SunxiCedrusDestroySurfaces(VADriverContextP context,
 	VASurfaceID *surfaces_ids, int surfaces_count);
 VAStatus SunxiCedrusSyncSurface(VADriverContextP context,
 	VASurfaceID surface_id);
+VAStatus surface_sync(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
+VAStatus surface_complete_queued(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
+VAStatus surface_sync_oldest(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object);
+VAStatus surface_acquire_source(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object);
+VAStatus surface_grow_source(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_context *context_object,
+	struct object_surface *surface_object, unsigned int size);
+void surface_bind_source(struct object_context *context_object,
+	struct object_surface *surface_object, unsigned int index);
+void surface_release_source(struct object_context *context_object,
+	struct object_surface *surface_object);
+VAStatus surface_complete_request(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object);
 VAStatus SunxiCedrusQuerySurfaceStatus(VADriverContextP context,
 	VASurfaceID surface_id, VASurfaceStatus *status);
 VAStatus SunxiCedrusPutSurface(VADriverContextP context, VASurfaceID surface_id,
@@ -0,0 +1,849 @@
+/*
+ * Copyright (c) 2014 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Portable and x86 versions of the MB32 detilers, along with the selection of
+ * the best implementation for the CPU. A tiled plane is made of rows of 32x32
+ * tiles, each stored as 1024 contiguous bytes, with tile rows covering the
+ * width rounded up to the tile width.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "tiled_yuv.h"
+
+typedef void (*tiled_to_planar_t)(void *src, void *dst, unsigned int dst_pitch,
+                                  unsigned int width, unsigned int height);
+typedef void (*tiled_deinterleave_to_planar_t)(void *src, void *dst1,
+                                               void *dst2,
+                                               unsigned int dst_pitch,
+                                               unsigned int width,
+                                               unsigned int height);
+
+/* Converts the 32 pixels of a tile line, from luma and interleaved chroma. */
+typedef void (*tiled_run_to_rgb_t)(const uint8_t *luma, const uint8_t *chroma,
+                                   uint8_t *dst,
+                                   const struct tiled_yuv_rgb *conversion);
+
+static void tiled_run_to_rgb_c(const uint8_t *luma, const uint8_t *chroma,
+                               uint8_t *dst,
+                               const struct tiled_yuv_rgb *conversion);
+
+static tiled_to_planar_t tiled_to_planar_function = tiled_to_planar_c;
+static tiled_deinterleave_to_planar_t tiled_deinterleave_to_planar_function =
+	tiled_deinterleave_to_planar_c;
+
+static tiled_run_to_rgb_t tiled_run_to_rgb_function = tiled_run_to_rgb_c;
+
+static inline uint8_t *tiled_line(void *src, unsigned int width, unsigned int y)
+{
+	unsigned int tiles_width = (width + TILED_YUV_TILE_WIDTH - 1) & ~(TILED_YUV_TILE_WIDTH - 1);
+
+	return (uint8_t *) src + (y / TILED_YUV_TILE_HEIGHT) * tiles_width * TILED_YUV_TILE_HEIGHT +
+		(y % TILED_YUV_TILE_HEIGHT) * TILED_YUV_TILE_WIDTH;
+}
+
+void tiled_to_planar_c(void *src, void *dst, unsigned int dst_pitch,
+                       unsigned int width, unsigned int height)
+{
+	uint8_t *s, *d;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) {
+		s = tiled_line(src, width, y);
+		d = (uint8_t *) dst + y * dst_pitch;
+
+		for (x = 0; x + TILED_YUV_TILE_WIDTH <= width; x += TILED_YUV_TILE_WIDTH) {
+			memcpy(d + x, s, TILED_YUV_TILE_WIDTH);
+			s += TILED_YUV_TILE_SIZE;
+		}
+
+		if (x < width)
+			memcpy(d + x, s, width - x);
+	}
+}
+
+void tiled_deinterleave_to_planar_c(void *src, void *dst1, void *dst2,
+                                    unsigned int dst_pitch,
+                                    unsigned int width, unsigned int height)
+{
+	uint8_t *s, *d1, *d2;
+	unsigned int x, y, i;
+
+	for (y = 0; y < height; y++) {
+		s = tiled_line(src, width, y);
+		d1 = (uint8_t *) dst1 + y * dst_pitch;
+		d2 = (uint8_t *) dst2 + y * dst_pitch;
+
+		for (x = 0; x < width / 2; x++) {
+			i = x * 2;
+			d1[x] = s[(i / TILED_YUV_TILE_WIDTH) * TILED_YUV_TILE_SIZE + i % TILED_YUV_TILE_WIDTH];
+			d2[x] = s[(i / TILED_YUV_TILE_WIDTH) * TILED_YUV_TILE_SIZE + i % TILED_YUV_TILE_WIDTH + 1];
+		}
+	}
+}
+
+/*
+ * Detiles a rectangle of a plane that is src_width wide, from any position:
+ * lines are copied in runs that stop at tile boundaries.
+ */
+void tiled_to_planar_rect(void *src, unsigned int src_width, void *dst,
+                          unsigned int dst_pitch, unsigned int x,
+                          unsigned int y, unsigned int width,
+                          unsigned int height)
+{
+	uint8_t *s, *d;
+	unsigned int column, offset, count;
+	unsigned int line;
+
+	for (line = 0; line < height; line++) {
+		s = tiled_line(src, src_width, y + line);
+		d = (uint8_t *) dst + line * dst_pitch;
+
+		for (column = x; column < x + width; column += count) {
+			offset = column % TILED_YUV_TILE_WIDTH;
+			count = TILED_YUV_TILE_WIDTH - offset;
+			if (count > x + width - column)
+				count = x + width - column;
+
+			memcpy(d, s + (column / TILED_YUV_TILE_WIDTH) * TILED_YUV_TILE_SIZE + offset, count);
+			d += count;
+		}
+	}
+}
+
+/* Same as above for interleaved data, starting at an even position. */
+void tiled_deinterleave_to_planar_rect(void *src, unsigned int src_width,
+                                       void *dst1, void *dst2,
+                                       unsigned int dst_pitch, unsigned int x,
+                                       unsigned int y, unsigned int width,
+                                       unsigned int height)
+{
+	uint8_t *s, *d1, *d2, *p;
+	unsigned int column;
+	unsigned int line, i;
+
+	for (line = 0; line < height; line++) {
+		s = tiled_line(src, src_width, y + line);
+		d1 = (uint8_t *) dst1 + line * dst_pitch;
+		d2 = (uint8_t *) dst2 + line * dst_pitch;
+
+		for (i = 0; i < width / 2; i++) {
+			column = x + i * 2;
+			p = s + (column / TILED_YUV_TILE_WIDTH) * TILED_YUV_TILE_SIZE + column % TILED_YUV_TILE_WIDTH;
+			d1[i] = p[0];
+			d2[i] = p[1];
+		}
+	}
+}
+
+static inline uint8_t *source_line(void *src, unsigned int src_width,
+                                   bool tiled, unsigned int y)
+{
+	if (tiled)
+		return tiled_line(src, src_width, y);
+
+	return (uint8_t *) src + y * src_width;
+}
+
+static inline unsigned int source_offset(bool tiled, unsigned int column)
+{
+	if (tiled)
+		return (column / TILED_YUV_TILE_WIDTH) * TILED_YUV_TILE_SIZE + column % TILED_YUV_TILE_WIDTH;
+
+	return column;
+}
+
+/*
+ * Averages boxes of 2^shift by 2^shift samples of a rectangle, with partial
+ * boxes on the right and bottom edges. Each source byte is read once.
+ * Interleaved samples are averaged per component and split between both
+ * destinations when there is a second one.
+ */
+static void planar_scaled(void *src, unsigned int src_width, bool tiled,
+                          void *dst1, void *dst2, unsigned int dst_pitch,
+                          unsigned int x, unsigned int y, unsigned int width,
+                          unsigned int height, unsigned int shift,
+                          bool interleaved)
+{
+	unsigned int step = interleaved ? 2 : 1;
+	unsigned int box = step << shift;
+	unsigned int samples = (width + box - 1) / box;
+	unsigned int column, column_end;
+	unsigned int line, line_end;
+	unsigned int sum, count;
+	unsigned int component;
+	unsigned int i, j, k;
+	uint8_t *s, *d1, *d2;
+	uint8_t value;
+
+	for (line = 0; line < height; line += 1 << shift) {
+		line_end = line + (1 << shift) < height ? line + (1 << shift) : height;
+		d1 = (uint8_t *) dst1 + (line >> shift) * dst_pitch;
+		d2 = dst2 != NULL ? (uint8_t *) dst2 + (line >> shift) * dst_pitch : NULL;
+
+		for (i = 0; i < samples; i++) {
+			column = x + i * box;
+			column_end = column + box < x + width ? column + box : x + width;
+
+			for (component = 0; component < step; component++) {
+				sum = 0;
+				count = 0;
+
+				for (j = line; j < line_end; j++) {
+					s = source_line(src, src_width, tiled, y + j);
+
+					for (k = column + component; k < column_end; k += step) {
+						sum += s[source_offset(tiled, k)];
+						count++;
+					}
+				}
+
+				value = (sum + count / 2) / count;
+
+				if (d2 == NULL)
+					d1[i * step + component] = value;
+				else if (component == 0)
+					d1[i] = value;
+				else
+					d2[i] = value;
+			}
+		}
+	}
+}
+
+void tiled_to_planar_scaled(void *src, unsigned int src_width, void *dst1,
+                            void *dst2, unsigned int dst_pitch,
+                            unsigned int x, unsigned int y, unsigned int width,
+                            unsigned int height, unsigned int shift,
+                            bool interleaved)
+{
+	planar_scaled(src, src_width, true, dst1, dst2, dst_pitch, x, y, width, height, shift, interleaved);
+}
+
+void linear_to_planar_scaled(void *src, unsigned int src_pitch, void *dst1,
+                             void *dst2, unsigned int dst_pitch,
+                             unsigned int x, unsigned int y, unsigned int width,
+                             unsigned int height, unsigned int shift,
+                             bool interleaved)
+{
+	planar_scaled(src, src_pitch, false, dst1, dst2, dst_pitch, x, y, width, height, shift, interleaved);
+}
+
+/* Destination offset of a sample, mirrored first and then rotated clockwise. */
+static inline long rotated_offset(long i, long j, unsigned int samples,
+                                  unsigned int lines, unsigned int rotation,
+                                  bool flip, unsigned int dst_pitch,
+                                  unsigned int dst_step)
+{
+	long u, v;
+
+	if (flip)
+		i = samples - 1 - i;
+
+	switch (rotation) {
+		case 1:
+			u = lines - 1 - j;
+			v = i;
+			break;
+		case 2:
+			u = samples - 1 - i;
+			v = lines - 1 - j;
+			break;
+		case 3:
+			u = j;
+			v = samples - 1 - i;
+			break;
+		default:
+			u = i;
+			v = j;
+			break;
+	}
+
+	return v * dst_pitch + u * dst_step;
+}
+
+/*
+ * Moves a block of 8x8 single samples, found at the same offset of 8 source
+ * lines. Lines of the block are kept when the destination offset moves by
+ * a whole pitch from one source line to the next, and transposed as 64-bit
+ * words when it moves by one byte. Reversed rows are byte swapped.
+ */
+static inline void rotated_block(uint8_t **lines, unsigned int offset,
+                                 uint8_t *dst, long base, long di, long dj,
+                                 unsigned int i, unsigned int j)
+{
+	uint64_t rows[8];
+	uint64_t a, b;
+	unsigned int k;
+
+	for (k = 0; k < 8; k++)
+		memcpy(&rows[k], lines[k] + offset, sizeof(rows[k]));
+
+	if (di == 1 || di == -1) {
+		for (k = 0; k < 8; k++) {
+			a = di < 0 ? __builtin_bswap64(rows[k]) : rows[k];
+			memcpy(dst + base + (di < 0 ? i + 7 : i) * di + (j + k) * dj, &a, sizeof(a));
+		}
+
+		return;
+	}
+
+	/* Swaps bytes, then 16-bit and 32-bit units between pairs of rows. */
+	for (k = 0; k < 8; k += 2) {
+		a = rows[k];
+		b = rows[k + 1];
+		rows[k] = (a & 0x00ff00ff00ff00ffULL) | ((b << 8) & 0xff00ff00ff00ff00ULL);
+		rows[k + 1] = ((a >> 8) & 0x00ff00ff00ff00ffULL) | (b & 0xff00ff00ff00ff00ULL);
+	}
+
+	for (k = 0; k < 8; k++) {
+		if (k & 2)
+			continue;
+
+		a = rows[k];
+		b = rows[k + 2];
+		rows[k] = (a & 0x0000ffff0000ffffULL) | ((b << 16) & 0xffff0000ffff0000ULL);
+		rows[k + 2] = ((a >> 16) & 0x0000ffff0000ffffULL) | (b & 0xffff0000ffff0000ULL);
+	}
+
+	for (k = 0; k < 4; k++) {
+		a = rows[k];
+		b = rows[k + 4];
+		rows[k] = (a & 0x00000000ffffffffULL) | (b << 32);
+		rows[k + 4] = (a >> 32) | (b & 0xffffffff00000000ULL);
+	}
+
+	/* Each row now holds a source column. */
+	for (k = 0; k < 8; k++) {
+		a = dj < 0 ? __builtin_bswap64(rows[k]) : rows[k];
+		memcpy(dst + base + (i + k) * di + (dj < 0 ? j + 7 : j) * dj, &a, sizeof(a));
+	}
+}
+
+/*
+ * Copies a rectangle rotated by quarter turns, mirrored horizontally first.
+ * Samples are read one tile at a time, so each tile lands in a block of the
+ * destination instead of being scattered over all of its lines. Planes of
+ * single samples are moved in blocks of 8x8 on little-endian CPUs, leaving
+ * the edges of the tiles to the sample loop.
+ */
+static void planar_rotated(void *src, unsigned int src_width, bool tiled,
+                           void *dst1, void *dst2, unsigned int dst_pitch,
+                           unsigned int x, unsigned int y, unsigned int width,
+                           unsigned int height, unsigned int rotation,
+                           bool flip, bool interleaved)
+{
+	unsigned int step = interleaved ? 2 : 1;
+	unsigned int dst_step = dst2 != NULL ? 1 : step;
+	unsigned int samples = width / step;
+	unsigned int line, line_end, lines_end;
+	unsigned int sample, sample_end, samples_end;
+	unsigned int i, j, k;
+	long base, di, dj;
+	uint8_t *s, *p, *d;
+	uint8_t *lines[8];
+	bool blocks;
+
+	/* The offset is linear in the sample and line of the source. */
+	base = rotated_offset(0, 0, samples, height, rotation, flip, dst_pitch, dst_step);
+	di = rotated_offset(1, 0, samples, height, rotation, flip, dst_pitch, dst_step) - base;
+	dj = rotated_offset(0, 1, samples, height, rotation, flip, dst_pitch, dst_step) - base;
+
+	blocks = step == 1 && dst2 == NULL && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+	for (line = 0; line < height; line = line_end) {
+		line_end = ((y + line) / TILED_YUV_TILE_HEIGHT + 1) * TILED_YUV_TILE_HEIGHT - y;
+		if (line_end > height)
+			line_end = height;
+
+		for (sample = 0; sample < samples; sample = sample_end) {
+			sample_end = (((x + sample * step) / TILED_YUV_TILE_WIDTH + 1) * TILED_YUV_TILE_WIDTH - x) / step;
+			if (sample_end > samples)
+				sample_end = samples;
+
+			lines_end = line;
+			samples_end = sample;
+
+			if (blocks) {
+				lines_end = line + (line_end - line) / 8 * 8;
+				samples_end = sample + (sample_end - sample) / 8 * 8;
+
+				for (j = line; j < lines_end; j += 8) {
+					for (k = 0; k < 8; k++)
+						lines[k] = source_line(src, src_width, tiled, y + j + k);
+
+					for (i = sample; i < samples_end; i += 8) {
+						rotated_block(lines, source_offset(tiled, x + i), dst1, base, di, dj, i, j);
+					}
+				}
+			}
+
+			for (j = line; j < line_end; j++) {
+				s = source_line(src, src_width, tiled, y + j);
+
+				for (i = j < lines_end ? samples_end : sample; i < sample_end; i++) {
+					p = s + source_offset(tiled, x + i * step);
+					d = (uint8_t *) dst1 + base + i * di + j * dj;
+
+					if (dst2 != NULL) {
+						d[0] = p[0];
+						((uint8_t *) dst2)[base + i * di + j * dj] = p[1];
+					} else if (step == 2) {
+						d[0] = p[0];
+						d[1] = p[1];
+					} else {
+						d[0] = p[0];
+					}
+				}
+			}
+		}
+	}
+}
+
+void tiled_to_planar_rotated(void *src, unsigned int src_width, void *dst1,
+                             void *dst2, unsigned int dst_pitch,
+                             unsigned int x, unsigned int y,
+                             unsigned int width, unsigned int height,
+                             unsigned int rotation, bool flip,
+                             bool interleaved)
+{
+	planar_rotated(src, src_width, true, dst1, dst2, dst_pitch, x, y, width, height, rotation, flip, interleaved);
+}
+
+void linear_to_planar_rotated(void *src, unsigned int src_pitch, void *dst1,
+                              void *dst2, unsigned int dst_pitch,
+                              unsigned int x, unsigned int y,
+                              unsigned int width, unsigned int height,
+                              unsigned int rotation, bool flip,
+                              bool interleaved)
+{
+	planar_rotated(src, src_pitch, false, dst1, dst2, dst_pitch, x, y, width, height, rotation, flip, interleaved);
+}
+
+/*
+ * BT.601 and BT.709 coefficients for limited and full range, scaled by 64:
+ * luma scale, V to red, U and V to green and U to blue.
+ */
+static const int16_t tiled_yuv_rgb_coefficients[2][2][5] = {
+	{ { 75, 102, 25, 52, 129 }, { 64, 90, 22, 46, 113 } },
+	{ { 75, 115, 14, 34, 135 }, { 64, 101, 12, 30, 119 } },
+};
+
+void tiled_yuv_rgb_init(struct tiled_yuv_rgb *conversion, bool bt709,
+                        bool full_range, bool bgr)
+{
+	const int16_t *coefficients = tiled_yuv_rgb_coefficients[bt709][full_range];
+
+	conversion->y_offset = full_range ? 0 : 16;
+	conversion->y_scale = coefficients[0];
+	conversion->v_r = coefficients[1];
+	conversion->u_g = coefficients[2];
+	conversion->v_g = coefficients[3];
+	conversion->u_b = coefficients[4];
+	conversion->bgr = bgr;
+}
+
+static inline uint8_t tiled_clamp(int value)
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* Pixels are written as 4 bytes, either R, G, B or B, G, R then opaque alpha. */
+static inline void tiled_pixel_to_rgb(uint8_t luma, uint8_t u, uint8_t v,
+                                      uint8_t *dst,
+                                      const struct tiled_yuv_rgb *conversion)
+{
+	int y = (luma - conversion->y_offset) * conversion->y_scale;
+	int r = (y + (v - 128) * conversion->v_r + 32) >> 6;
+	int g = (y - ((u - 128) * conversion->u_g + (v - 128) * conversion->v_g) + 32) >> 6;
+	int b = (y + (u - 128) * conversion->u_b + 32) >> 6;
+
+	dst[conversion->bgr ? 2 : 0] = tiled_clamp(r);
+	dst[1] = tiled_clamp(g);
+	dst[conversion->bgr ? 0 : 2] = tiled_clamp(b);
+	dst[3] = 0xff;
+}
+
+static void tiled_run_to_rgb_c(const uint8_t *luma, const uint8_t *chroma,
+                               uint8_t *dst,
+                               const struct tiled_yuv_rgb *conversion)
+{
+	unsigned int i;
+
+	for (i = 0; i < TILED_YUV_TILE_WIDTH; i++)
+		tiled_pixel_to_rgb(luma[i], chroma[i & ~1], chroma[i | 1], dst + i * 4, conversion);
+}
+
+/*
+ * Converts a rectangle of a tiled picture to RGB, reading luma and chroma
+ * tiles directly. Whole tile lines go through the optimized converter.
+ */
+void tiled_to_rgb(void *src_luma, void *src_chroma, unsigned int src_width,
+                  void *dst, unsigned int dst_pitch, unsigned int x,
+                  unsigned int y, unsigned int width, unsigned int height,
+                  const struct tiled_yuv_rgb *conversion)
+{
+	uint8_t *s, *c, *d;
+	unsigned int column, offset;
+	unsigned int line;
+
+	for (line = 0; line < height; line++) {
+		s = tiled_line(src_luma, src_width, y + line);
+		c = tiled_line(src_chroma, src_width, (y + line) / 2);
+		d = (uint8_t *) dst + line * dst_pitch;
+
+		for (column = x; column < x + width; column++, d += 4) {
+			offset = (column / TILED_YUV_TILE_WIDTH) * TILED_YUV_TILE_SIZE;
+
+			if (column % TILED_YUV_TILE_WIDTH == 0 && x + width - column >= TILED_YUV_TILE_WIDTH) {
+				tiled_run_to_rgb_function(s + offset, c + offset, d, conversion);
+				column += TILED_YUV_TILE_WIDTH - 1;
+				d += (TILED_YUV_TILE_WIDTH - 1) * 4;
+				continue;
+			}
+
+			offset += column % TILED_YUV_TILE_WIDTH;
+			tiled_pixel_to_rgb(s[offset], c[offset & ~1], c[offset | 1], d, conversion);
+		}
+	}
+}
+
+/* Same as above for linear NV12, as written by some video engines. */
+void nv12_to_rgb(void *src_luma, void *src_chroma, unsigned int src_pitch,
+                 void *dst, unsigned int dst_pitch, unsigned int x,
+                 unsigned int y, unsigned int width, unsigned int height,
+                 const struct tiled_yuv_rgb *conversion)
+{
+	uint8_t *s, *c, *d;
+	unsigned int column;
+	unsigned int line;
+
+	for (line = 0; line < height; line++) {
+		s = (uint8_t *) src_luma + (y + line) * src_pitch;
+		c = (uint8_t *) src_chroma + ((y + line) / 2) * src_pitch;
+		d = (uint8_t *) dst + line * dst_pitch;
+
+		for (column = x; column < x + width; column++, d += 4) {
+			if (column % 2 == 0 && x + width - column >= TILED_YUV_TILE_WIDTH) {
+				tiled_run_to_rgb_function(s + column, c + column, d, conversion);
+				column += TILED_YUV_TILE_WIDTH - 1;
+				d += (TILED_YUV_TILE_WIDTH - 1) * 4;
+				continue;
+			}
+
+			tiled_pixel_to_rgb(s[column], c[column & ~1], c[column | 1], d, conversion);
+		}
+	}
+}
+
+/*
+ * ARMv7 only gets the intrinsics when NEON is enabled at build time, the
+ * detilers are in assembly and do not depend on it.
+ */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static void tiled_run_to_rgb_neon(const uint8_t *luma, const uint8_t *chroma,
+                                  uint8_t *dst,
+                                  const struct tiled_yuv_rgb *conversion)
+{
+	int16x8_t bias = vdupq_n_s16(128);
+	int16x8_t y_offset = vdupq_n_s16(conversion->y_offset);
+	int16x8_t y_scale = vdupq_n_s16(conversion->y_scale);
+	int16x8_t v_r = vdupq_n_s16(conversion->v_r);
+	int16x8_t u_g = vdupq_n_s16(conversion->u_g);
+	int16x8_t v_g = vdupq_n_s16(conversion->v_g);
+	int16x8_t u_b = vdupq_n_s16(conversion->u_b);
+	int16x8_t u, v, t, yl, yh;
+	int16x8x2_t cr, cg, cb;
+	uint8x16_t y, r, g, b;
+	uint8x8x2_t uv;
+	uint8x16x4_t pixels;
+	unsigned int i;
+
+	pixels.val[3] = vdupq_n_u8(0xff);
+
+	for (i = 0; i < TILED_YUV_TILE_WIDTH; i += 16) {
+		y = vld1q_u8(luma + i);
+		uv = vld2_u8(chroma + i);
+
+		u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uv.val[0])), bias);
+		v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uv.val[1])), bias);
+
+		/* Each chroma sample is shared by two pixels. */
+		t = vmulq_s16(v, v_r);
+		cr = vzipq_s16(t, t);
+		t = vmlaq_s16(vmulq_s16(u, u_g), v, v_g);
+		cg = vzipq_s16(t, t);
+		t = vmulq_s16(u, u_b);
+		cb = vzipq_s16(t, t);
+
+		yl = vmulq_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y))), y_offset), y_scale);
+		yh = vmulq_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y))), y_offset), y_scale);
+
+		/* Saturating sums and narrowing clamp like the portable version. */
+		r = vcombine_u8(vqmovun_s16(vrshrq_n_s16(vqaddq_s16(yl, cr.val[0]), 6)),
+				vqmovun_s16(vrshrq_n_s16(vqaddq_s16(yh, cr.val[1]), 6)));
+		g = vcombine_u8(vqmovun_s16(vrshrq_n_s16(vqsubq_s16(yl, cg.val[0]), 6)),
+				vqmovun_s16(vrshrq_n_s16(vqsubq_s16(yh, cg.val[1]), 6)));
+		b = vcombine_u8(vqmovun_s16(vrshrq_n_s16(vqaddq_s16(yl, cb.val[0]), 6)),
+				vqmovun_s16(vrshrq_n_s16(vqaddq_s16(yh, cb.val[1]), 6)));
+
+		pixels.val[0] = conversion->bgr ? b : r;
+		pixels.val[1] = g;
+		pixels.val[2] = conversion->bgr ? r : b;
+
+		vst4q_u8(dst + i * 4, pixels);
+	}
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static void tiled_run_to_rgb_sse2(const uint8_t *luma, const uint8_t *chroma,
+                                  uint8_t *dst,
+                                  const struct tiled_yuv_rgb *conversion)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i alpha = _mm_set1_epi8((char) 0xff);
+	__m128i mask = _mm_set1_epi16(0x00ff);
+	__m128i bias = _mm_set1_epi16(128);
+	__m128i round = _mm_set1_epi16(32);
+	__m128i y_offset = _mm_set1_epi16(conversion->y_offset);
+	__m128i y_scale = _mm_set1_epi16(conversion->y_scale);
+	__m128i v_r = _mm_set1_epi16(conversion->v_r);
+	__m128i u_g = _mm_set1_epi16(conversion->u_g);
+	__m128i v_g = _mm_set1_epi16(conversion->v_g);
+	__m128i u_b = _mm_set1_epi16(conversion->u_b);
+	__m128i y, uv, u, v, cr, cg, cb, yl, yh;
+	__m128i r, g, b, rg, ba, t;
+	unsigned int i;
+
+	for (i = 0; i < TILED_YUV_TILE_WIDTH; i += 16) {
+		y = _mm_loadu_si128((__m128i *) (luma + i));
+		uv = _mm_loadu_si128((__m128i *) (chroma + i));
+
+		u = _mm_sub_epi16(_mm_and_si128(uv, mask), bias);
+		v = _mm_sub_epi16(_mm_srli_epi16(uv, 8), bias);
+
+		cr = _mm_mullo_epi16(v, v_r);
+		cg = _mm_add_epi16(_mm_mullo_epi16(u, u_g), _mm_mullo_epi16(v, v_g));
+		cb = _mm_mullo_epi16(u, u_b);
+
+		yl = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), y_offset), y_scale);
+		yh = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), y_offset), y_scale);
+
+		/* Each chroma sample is shared by two pixels, saturation clamps. */
+		r = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yl, _mm_unpacklo_epi16(cr, cr)), round), 6),
+			_mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yh, _mm_unpackhi_epi16(cr, cr)), round), 6));
+		g = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_adds_epi16(_mm_subs_epi16(yl, _mm_unpacklo_epi16(cg, cg)), round), 6),
+			_mm_srai_epi16(_mm_adds_epi16(_mm_subs_epi16(yh, _mm_unpackhi_epi16(cg, cg)), round), 6));
+		b = _mm_packus_epi16(
+			_mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yl, _mm_unpacklo_epi16(cb, cb)), round), 6),
+			_mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(yh, _mm_unpackhi_epi16(cb, cb)), round), 6));
+
+		if (conversion->bgr) {
+			t = r;
+			r = b;
+			b = t;
+		}
+
+		rg = _mm_unpacklo_epi8(r, g);
+		ba = _mm_unpacklo_epi8(b, alpha);
+		_mm_storeu_si128((__m128i *) (dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i *) (dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+
+		rg = _mm_unpackhi_epi8(r, g);
+		ba = _mm_unpackhi_epi8(b, alpha);
+		_mm_storeu_si128((__m128i *) (dst + i * 4 + 32), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i *) (dst + i * 4 + 48), _mm_unpackhi_epi16(rg, ba));
+	}
+}
+
+__attribute__((target("sse2")))
+void tiled_to_planar_sse2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height)
+{
+	uint8_t *s, *d;
+	unsigned int x, y;
+	__m128i a, b;
+
+	for (y = 0; y < height; y++) {
+		s = tiled_line(src, width, y);
+		d = (uint8_t *) dst + y * dst_pitch;
+
+		for (x = 0; x + TILED_YUV_TILE_WIDTH <= width; x += TILED_YUV_TILE_WIDTH) {
+			a = _mm_load_si128((__m128i *) s);
+			b = _mm_load_si128((__m128i *) (s + 16));
+			_mm_storeu_si128((__m128i *) (d + x), a);
+			_mm_storeu_si128((__m128i *) (d + x + 16), b);
+			s += TILED_YUV_TILE_SIZE;
+		}
+
+		if (x < width)
+			memcpy(d + x, s, width - x);
+	}
+}
+
+__attribute__((target("sse2")))
+void tiled_deinterleave_to_planar_sse2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width,
+                                       unsigned int height)
+{
+	__m128i mask = _mm_set1_epi16(0x00ff);
+	uint8_t *s, *d1, *d2;
+	unsigned int x, y;
+	__m128i a, b;
+
+	for (y = 0; y < height; y++) {
+		s = tiled_line(src, width, y);
+		d1 = (uint8_t *) dst1 + y * dst_pitch;
+		d2 = (uint8_t *) dst2 + y * dst_pitch;
+
+		/* Even and odd bytes are split by packing the 16-bit pairs. */
+		for (x = 0; x + TILED_YUV_TILE_WIDTH <= width; x += TILED_YUV_TILE_WIDTH) {
+			a = _mm_load_si128((__m128i *) s);
+			b = _mm_load_si128((__m128i *) (s + 16));
+			_mm_storeu_si128((__m128i *) (d1 + x / 2), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+			_mm_storeu_si128((__m128i *) (d2 + x / 2), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+			s += TILED_YUV_TILE_SIZE;
+		}
+
+		for (; x + 1 < width; x += 2) {
+			d1[x / 2] = s[x % TILED_YUV_TILE_WIDTH];
+			d2[x / 2] = s[x % TILED_YUV_TILE_WIDTH + 1];
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+void tiled_to_planar_avx2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height)
+{
+	uint8_t *s, *d;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) {
+		s = tiled_line(src, width, y);
+		d = (uint8_t *) dst + y * dst_pitch;
+
+		for (x = 0; x + TILED_YUV_TILE_WIDTH <= width; x += TILED_YUV_TILE_WIDTH) {
+			_mm256_storeu_si256((__m256i *) (d + x), _mm256_load_si256((__m256i *) s));
+			s += TILED_YUV_TILE_SIZE;
+		}
+
+		if (x < width)
+			memcpy(d + x, s, width - x);
+	}
+}
+
+__attribute__((target("avx2")))
+void tiled_deinterleave_to_planar_avx2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width,
+                                       unsigned int height)
+{
+	__m256i mask = _mm256_set1_epi16(0x00ff);
+	uint8_t *s, *d1, *d2;
+	unsigned int x, y;
+	__m256i a, p;
+
+	for (y = 0; y < height; y++) {
+		s = tiled_line(src, width, y);
+		d1 = (uint8_t *) dst1 + y * dst_pitch;
+		d2 = (uint8_t *) dst2 + y * dst_pitch;
+
+		/*
+		 * Packing works within 128-bit lanes, so the even and odd
+		 * halves of both lanes are gathered with a permutation.
+		 */
+		for (x = 0; x + TILED_YUV_TILE_WIDTH <= width; x += TILED_YUV_TILE_WIDTH) {
+			a = _mm256_load_si256((__m256i *) s);
+			p = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_srli_epi16(a, 8));
+			p = _mm256_permute4x64_epi64(p, 0xd8);
+			_mm_storeu_si128((__m128i *) (d1 + x / 2), _mm256_castsi256_si128(p));
+			_mm_storeu_si128((__m128i *) (d2 + x / 2), _mm256_extracti128_si256(p, 1));
+			s += TILED_YUV_TILE_SIZE;
+		}
+
+		for (; x + 1 < width; x += 2) {
+			d1[x / 2] = s[x % TILED_YUV_TILE_WIDTH];
+			d2[x / 2] = s[x % TILED_YUV_TILE_WIDTH + 1];
+		}
+	}
+}
+
+#endif
+
+void tiled_yuv_init(void)
+{
+#if defined(__arm__)
+	tiled_to_planar_function = tiled_to_planar_neon_blocked;
+	tiled_deinterleave_to_planar_function = tiled_deinterleave_to_planar_neon;
+#elif defined(__aarch64__)
+	tiled_to_planar_function = tiled_to_planar_neon64;
+	tiled_deinterleave_to_planar_function = tiled_deinterleave_to_planar_neon64;
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	tiled_run_to_rgb_function = tiled_run_to_rgb_neon;
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		tiled_to_planar_function = tiled_to_planar_avx2;
+		tiled_deinterleave_to_planar_function = tiled_deinterleave_to_planar_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		tiled_to_planar_function = tiled_to_planar_sse2;
+		tiled_deinterleave_to_planar_function = tiled_deinterleave_to_planar_sse2;
+	}
+
+	if (__builtin_cpu_supports("sse2"))
+		tiled_run_to_rgb_function = tiled_run_to_rgb_sse2;
+#endif
+}
+
+void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
+                     unsigned int width, unsigned int height)
+{
+	tiled_to_planar_function(src, dst, dst_pitch, width, height);
+}
+
+void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
+                                  unsigned int dst_pitch,
+                                  unsigned int width, unsigned int height)
+{
+	tiled_deinterleave_to_planar_function(src, dst1, dst2, dst_pitch, width, height);
+}
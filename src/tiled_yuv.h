@@ -20,6 +20,26 @@
 #ifndef _TILED_YUV_H_
 #define _TILED_YUV_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TILED_YUV_TILE_WIDTH	32
+#define TILED_YUV_TILE_HEIGHT	32
+#define TILED_YUV_TILE_SIZE	(TILED_YUV_TILE_WIDTH * TILED_YUV_TILE_HEIGHT)
+
+/* YUV to RGB conversion, with coefficients in 1/64 units. */
+struct tiled_yuv_rgb {
+	int16_t y_offset;
+	int16_t y_scale;
+	int16_t v_r;
+	int16_t u_g;
+	int16_t v_g;
+	int16_t u_b;
+	bool bgr;
+};
+
+void tiled_yuv_init(void);
+
 void tiled_to_planar(void *src, void *dst, unsigned int dst_pitch,
                      unsigned int width, unsigned int height);
 
@@ -27,4 +47,102 @@ void tiled_deinterleave_to_planar(void *src, void *dst1, void *dst2,
                                   unsigned int dst_pitch,
                                   unsigned int width, unsigned int height);
 
+void tiled_to_planar_rect(void *src, unsigned int src_width, void *dst,
+                          unsigned int dst_pitch, unsigned int x,
+                          unsigned int y, unsigned int width,
+                          unsigned int height);
+
+void tiled_deinterleave_to_planar_rect(void *src, unsigned int src_width,
+                                       void *dst1, void *dst2,
+                                       unsigned int dst_pitch, unsigned int x,
+                                       unsigned int y, unsigned int width,
+                                       unsigned int height);
+
+void tiled_to_planar_scaled(void *src, unsigned int src_width, void *dst1,
+                            void *dst2, unsigned int dst_pitch,
+                            unsigned int x, unsigned int y, unsigned int width,
+                            unsigned int height, unsigned int shift,
+                            bool interleaved);
+
+void linear_to_planar_scaled(void *src, unsigned int src_pitch, void *dst1,
+                             void *dst2, unsigned int dst_pitch,
+                             unsigned int x, unsigned int y, unsigned int width,
+                             unsigned int height, unsigned int shift,
+                             bool interleaved);
+
+void tiled_to_planar_rotated(void *src, unsigned int src_width, void *dst1,
+                             void *dst2, unsigned int dst_pitch,
+                             unsigned int x, unsigned int y,
+                             unsigned int width, unsigned int height,
+                             unsigned int rotation, bool flip,
+                             bool interleaved);
+
+void linear_to_planar_rotated(void *src, unsigned int src_pitch, void *dst1,
+                              void *dst2, unsigned int dst_pitch,
+                              unsigned int x, unsigned int y,
+                              unsigned int width, unsigned int height,
+                              unsigned int rotation, bool flip,
+                              bool interleaved);
+
+void tiled_yuv_rgb_init(struct tiled_yuv_rgb *conversion, bool bt709,
+                        bool full_range, bool bgr);
+
+void tiled_to_rgb(void *src_luma, void *src_chroma, unsigned int src_width,
+                  void *dst, unsigned int dst_pitch, unsigned int x,
+                  unsigned int y, unsigned int width, unsigned int height,
+                  const struct tiled_yuv_rgb *conversion);
+
+void nv12_to_rgb(void *src_luma, void *src_chroma, unsigned int src_pitch,
+                 void *dst, unsigned int dst_pitch, unsigned int x,
+                 unsigned int y, unsigned int width, unsigned int height,
+                 const struct tiled_yuv_rgb *conversion);
+
+void tiled_to_planar_c(void *src, void *dst, unsigned int dst_pitch,
+                       unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_c(void *src, void *dst1, void *dst2,
+                                    unsigned int dst_pitch,
+                                    unsigned int width, unsigned int height);
+
+#if defined(__arm__)
+void tiled_to_planar_neon(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height);
+
+void tiled_to_planar_neon_blocked(void *src, void *dst, unsigned int dst_pitch,
+                                  unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_neon(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width,
+                                       unsigned int height);
+#endif
+
+#if defined(__aarch64__)
+void tiled_to_planar_neon64(void *src, void *dst, unsigned int dst_pitch,
+                            unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_neon64(void *src, void *dst1, void *dst2,
+                                         unsigned int dst_pitch,
+                                         unsigned int width,
+                                         unsigned int height);
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+void tiled_to_planar_sse2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_sse2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width,
+                                       unsigned int height);
+
+void tiled_to_planar_avx2(void *src, void *dst, unsigned int dst_pitch,
+                          unsigned int width, unsigned int height);
+
+void tiled_deinterleave_to_planar_avx2(void *src, void *dst1, void *dst2,
+                                       unsigned int dst_pitch,
+                                       unsigned int width,
+                                       unsigned int height);
+#endif
+
 #endif
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "sunxi_cedrus.h"
 #include "utils.h"
@@ -40,3 +41,13 @@ void sunxi_cedrus_log(const char *format, ...)
 	vfprintf(stderr, format, arguments);
 	va_end(arguments);
 }
+
+/* Returns a monotonic timestamp, in microseconds. */
+uint64_t sunxi_cedrus_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
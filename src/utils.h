@@ -26,6 +26,9 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
+#include <stdint.h>
+
 void sunxi_cedrus_log(const char *format, ...);
+uint64_t sunxi_cedrus_timestamp(void);
 
 #endif
@@ -56,7 +56,7 @@ bool v4l2_find_format(int video_fd, unsigned int type, unsigned int pixelformat)
 }
 
 int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
-	unsigned int width, unsigned int height)
+	unsigned int width, unsigned int height, unsigned int size)
 {
 	struct v4l2_format format;
 	int rc;
@@ -65,7 +65,7 @@ int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
 	format.type = type;
 	format.fmt.pix_mp.width = width;
 	format.fmt.pix_mp.height = height;
-	format.fmt.pix_mp.plane_fmt[0].sizeimage = type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE ? DESTINATION_SIZE_MAX : 0;
+	format.fmt.pix_mp.plane_fmt[0].sizeimage = size;
 	format.fmt.pix_mp.pixelformat = pixelformat;
 	format.fmt.pix_mp.field = V4L2_FIELD_ANY;
 	format.fmt.pix_mp.num_planes = type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? 2 : 1;
@@ -79,8 +79,29 @@ int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
 	return 0;
 }
 
+/* Returns the line stride of the first plane of the current format. */
+int v4l2_get_format_pitch(int video_fd, unsigned int type,
+	unsigned int *bytesperline)
+{
+	struct v4l2_format format;
+	int rc;
+
+	memset(&format, 0, sizeof(format));
+	format.type = type;
+
+	rc = ioctl(video_fd, VIDIOC_G_FMT, &format);
+	if (rc < 0) {
+		sunxi_cedrus_log("Unable to get format for type %d: %s\n", type, strerror(errno));
+		return -1;
+	}
+
+	*bytesperline = format.fmt.pix_mp.plane_fmt[0].bytesperline;
+
+	return 0;
+}
+
 int v4l2_create_buffers(int video_fd, unsigned int type,
-	unsigned int buffers_count)
+	unsigned int buffers_count, unsigned int size, unsigned int *index)
 {
 	struct v4l2_create_buffers buffers;
 	int rc;
@@ -96,12 +117,48 @@ int v4l2_create_buffers(int video_fd, unsigned int type,
 		return -1;
 	}
 
+	/* Buffers can be created larger than the format requires. */
+	if (size > buffers.format.fmt.pix_mp.plane_fmt[0].sizeimage)
+		buffers.format.fmt.pix_mp.plane_fmt[0].sizeimage = size;
+
 	rc = ioctl(video_fd, VIDIOC_CREATE_BUFS, &buffers);
 	if (rc < 0) {
 		sunxi_cedrus_log("Unable to create buffer for type %d: %s\n", type, strerror(errno));
 		return -1;
 	}
 
+	if (index != NULL)
+		*index = buffers.index;
+
+	return 0;
+}
+
+int v4l2_query_buffers_capabilities(int video_fd, unsigned int type,
+	unsigned int *capabilities)
+{
+	struct v4l2_create_buffers buffers;
+	int rc;
+
+	memset(&buffers, 0, sizeof(buffers));
+	buffers.format.type = type;
+	buffers.memory = V4L2_MEMORY_MMAP;
+	buffers.count = 0;
+
+	rc = ioctl(video_fd, VIDIOC_G_FMT, &buffers.format);
+	if (rc < 0) {
+		sunxi_cedrus_log("Unable to get format for type %d: %s\n", type, strerror(errno));
+		return -1;
+	}
+
+	/* No buffer is created when the count is zero. */
+	rc = ioctl(video_fd, VIDIOC_CREATE_BUFS, &buffers);
+	if (rc < 0) {
+		sunxi_cedrus_log("Unable to query buffers capabilities for type %d: %s\n", type, strerror(errno));
+		return -1;
+	}
+
+	*capabilities = buffers.capabilities;
+
 	return 0;
 }
 
@@ -149,7 +206,8 @@ int v4l2_request_buffer(int video_fd, unsigned int type, unsigned int index,
 }
 
 int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
-	unsigned int index, unsigned int size)
+	struct timeval *timestamp, unsigned int index, unsigned int size,
+	unsigned int flags)
 {
 	struct v4l2_plane planes[2];
 	struct v4l2_buffer buffer;
@@ -165,9 +223,13 @@ int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
 	buffer.m.planes = planes;
 
 	buffer.m.planes[0].bytesused = size;
+	buffer.flags = flags;
+
+	if (timestamp != NULL)
+		buffer.timestamp = *timestamp;
 
 	if (request_fd >= 0) {
-		buffer.flags = V4L2_BUF_FLAG_REQUEST_FD;
+		buffer.flags |= V4L2_BUF_FLAG_REQUEST_FD;
 		buffer.request_fd = request_fd;
 	}
 
@@ -214,27 +276,35 @@ int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
 	unsigned int size)
 {
 	struct v4l2_ext_control control;
-	struct v4l2_ext_controls controls;
-	int rc;
 
 	memset(&control, 0, sizeof(control));
-	memset(&controls, 0, sizeof(controls));
 
 	control.id = id;
 	control.ptr = data;
 	control.size = size;
 
-	controls.controls = &control;
-	controls.count = 1;
+	return v4l2_set_controls(video_fd, request_fd, &control, 1);
+}
+
+int v4l2_set_controls(int video_fd, int request_fd,
+	struct v4l2_ext_control *controls, unsigned int controls_count)
+{
+	struct v4l2_ext_controls ext_controls;
+	int rc;
+
+	memset(&ext_controls, 0, sizeof(ext_controls));
+
+	ext_controls.controls = controls;
+	ext_controls.count = controls_count;
 
 	if (request_fd >= 0) {
-		controls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
-		controls.request_fd = request_fd;
+		ext_controls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		ext_controls.request_fd = request_fd;
 	}
 
-	rc = ioctl(video_fd, VIDIOC_S_EXT_CTRLS, &controls);
+	rc = ioctl(video_fd, VIDIOC_S_EXT_CTRLS, &ext_controls);
 	if (rc < 0) {
-		sunxi_cedrus_log("Unable to set control: %s\n", strerror(errno));
+		sunxi_cedrus_log("Unable to set controls: %s\n", strerror(errno));
 		return -1;
 	}
 
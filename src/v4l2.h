@@ -27,22 +27,31 @@
 
 #include <stdbool.h>
 
-#define DESTINATION_SIZE_MAX					(1024 * 1024)
+#include <sys/time.h>
+
+#include <linux/videodev2.h>
 
 bool v4l2_find_format(int video_fd, unsigned int type,
 	unsigned int pixelformat);
 int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
-	unsigned int width, unsigned int height);
+	unsigned int width, unsigned int height, unsigned int size);
+int v4l2_get_format_pitch(int video_fd, unsigned int type,
+	unsigned int *bytesperline);
 int v4l2_create_buffers(int video_fd, unsigned int type,
-	unsigned int buffers_count);
+	unsigned int buffers_count, unsigned int size, unsigned int *index);
+int v4l2_query_buffers_capabilities(int video_fd, unsigned int type,
+	unsigned int *capabilities);
 int v4l2_request_buffer(int video_fd, unsigned int type, unsigned int index,
 	unsigned int *length, unsigned int *offset);
 int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
-	unsigned int index, unsigned int size);
+	struct timeval *timestamp, unsigned int index, unsigned int size,
+	unsigned int flags);
 int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
 	unsigned int index);
 int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
 	unsigned int size);
+int v4l2_set_controls(int video_fd, int request_fd,
+	struct v4l2_ext_control *controls, unsigned int controls_count);
 int v4l2_set_stream(int video_fd, unsigned int type, bool enable);
 
 #endif
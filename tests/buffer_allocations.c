@@ -0,0 +1,582 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Decodes a synthetic MPEG-2 stream through the driver entry points, from the
+ * creation of the buffers of each picture to its completion, and checks that
+ * no heap allocation happens once the driver is warm. The video and media
+ * devices are replaced by stubs backed by a temporary file and the reactor is
+ * emulated by completing each picture once the next one was submitted.
+ * Allocations are counted through linker wrappers.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <linux/videodev2.h>
+
+#include "sunxi_cedrus.h"
+#include "buffer.h"
+#include "config.h"
+#include "context.h"
+#include "picture.h"
+#include "surface.h"
+#include "image.h"
+
+#include "v4l2.h"
+#include "media.h"
+#include "reactor.h"
+#include "readback.h"
+
+#define PICTURE_WIDTH		720
+#define PICTURE_HEIGHT		576
+#define SURFACES_COUNT		8
+#define FRAMES_WARMUP_COUNT	16
+#define FRAMES_COUNT		1000
+#define SLICES_COUNT		4
+
+#define DEVICE_BUFFERS_MAX	64
+
+struct device_buffer {
+	unsigned int length[2];
+	unsigned int offset[2];
+};
+
+/* Buffers of the stub device are carved out of a temporary file. */
+static struct {
+	int fd;
+	unsigned int size;
+	unsigned int output_size;
+	unsigned int capture_width;
+	unsigned int capture_height;
+	struct device_buffer output_buffers[DEVICE_BUFFERS_MAX];
+	unsigned int output_buffers_count;
+	struct device_buffer capture_buffers[DEVICE_BUFFERS_MAX];
+	unsigned int capture_buffers_count;
+} device;
+
+static unsigned long allocations_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *data, size_t size);
+int __real_posix_memalign(void **data, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocations_count++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	allocations_count++;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *data, size_t size)
+{
+	allocations_count++;
+	return __real_realloc(data, size);
+}
+
+int __wrap_posix_memalign(void **data, size_t alignment, size_t size)
+{
+	allocations_count++;
+	return __real_posix_memalign(data, alignment, size);
+}
+
+static int device_allocate(unsigned int length, unsigned int *offset)
+{
+	unsigned int page_size = sysconf(_SC_PAGESIZE);
+
+	*offset = device.size;
+	device.size += (length + page_size - 1) & ~(page_size - 1);
+
+	return ftruncate(device.fd, device.size);
+}
+
+bool v4l2_find_format(int video_fd, unsigned int type,
+	unsigned int pixelformat)
+{
+	return false;
+}
+
+int v4l2_set_format(int video_fd, unsigned int type, unsigned int pixelformat,
+	unsigned int width, unsigned int height, unsigned int size)
+{
+	if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+		device.output_size = size;
+	} else {
+		device.capture_width = width;
+		device.capture_height = height;
+	}
+
+	return 0;
+}
+
+int v4l2_get_format_pitch(int video_fd, unsigned int type,
+	unsigned int *bytesperline)
+{
+	*bytesperline = (device.capture_width + 31) & ~31;
+
+	return 0;
+}
+
+int v4l2_create_buffers(int video_fd, unsigned int type,
+	unsigned int buffers_count, unsigned int size, unsigned int *index)
+{
+	struct device_buffer *buffer;
+	unsigned int pixels = device.capture_width * device.capture_height;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < buffers_count; i++) {
+		if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+			if (device.output_buffers_count >= DEVICE_BUFFERS_MAX)
+				return -1;
+
+			if (i == 0 && index != NULL)
+				*index = device.output_buffers_count;
+
+			buffer = &device.output_buffers[device.output_buffers_count++];
+			buffer->length[0] = size > 0 ? size : device.output_size;
+
+			rc = device_allocate(buffer->length[0], &buffer->offset[0]);
+		} else {
+			if (device.capture_buffers_count >= DEVICE_BUFFERS_MAX)
+				return -1;
+
+			if (i == 0 && index != NULL)
+				*index = device.capture_buffers_count;
+
+			buffer = &device.capture_buffers[device.capture_buffers_count++];
+			buffer->length[0] = pixels;
+			buffer->length[1] = pixels / 2;
+
+			rc = device_allocate(buffer->length[0], &buffer->offset[0]);
+			if (rc == 0)
+				rc = device_allocate(buffer->length[1], &buffer->offset[1]);
+		}
+
+		if (rc < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int v4l2_query_buffers_capabilities(int video_fd, unsigned int type,
+	unsigned int *capabilities)
+{
+	*capabilities = 0;
+
+	return 0;
+}
+
+int v4l2_request_buffer(int video_fd, unsigned int type, unsigned int index,
+	unsigned int *length, unsigned int *offset)
+{
+	struct device_buffer *buffer;
+
+	if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+		if (index >= device.output_buffers_count)
+			return -1;
+
+		buffer = &device.output_buffers[index];
+		*length = buffer->length[0];
+		*offset = buffer->offset[0];
+	} else {
+		if (index >= device.capture_buffers_count)
+			return -1;
+
+		buffer = &device.capture_buffers[index];
+		memcpy(length, buffer->length, sizeof(buffer->length));
+		memcpy(offset, buffer->offset, sizeof(buffer->offset));
+	}
+
+	return 0;
+}
+
+int v4l2_queue_buffer(int video_fd, int request_fd, unsigned int type,
+	struct timeval *timestamp, unsigned int index, unsigned int size,
+	unsigned int flags)
+{
+	return 0;
+}
+
+int v4l2_dequeue_buffer(int video_fd, int request_fd, unsigned int type,
+	unsigned int index)
+{
+	return 0;
+}
+
+int v4l2_set_control(int video_fd, int request_fd, unsigned int id, void *data,
+	unsigned int size)
+{
+	return 0;
+}
+
+int v4l2_set_controls(int video_fd, int request_fd,
+	struct v4l2_ext_control *controls, unsigned int controls_count)
+{
+	return 0;
+}
+
+int v4l2_set_stream(int video_fd, unsigned int type, bool enable)
+{
+	return 0;
+}
+
+int media_request_alloc(int media_fd)
+{
+	return open("/dev/null", O_RDWR);
+}
+
+int media_request_reinit(int request_fd)
+{
+	return 0;
+}
+
+int media_request_queue(int request_fd)
+{
+	return 0;
+}
+
+int media_request_wait_completion(int request_fd, unsigned int timeout)
+{
+	return 0;
+}
+
+/* Pictures are completed by the test itself, see complete_picture. */
+int reactor_watch_request(struct sunxi_cedrus_driver_data *driver_data,
+	int request_fd, struct object_surface *surface_object)
+{
+	return 0;
+}
+
+int reactor_unwatch_request(struct sunxi_cedrus_driver_data *driver_data,
+	int request_fd)
+{
+	return 0;
+}
+
+/* Readback is disabled and no image is derived from the surfaces. */
+void readback_queue_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+}
+
+void readback_cancel_surface(struct sunxi_cedrus_driver_data *driver_data,
+	struct object_surface *surface_object)
+{
+}
+
+bool image_wraps_readback(struct sunxi_cedrus_driver_data *driver_data,
+	void *data)
+{
+	return false;
+}
+
+bool image_wraps_destination(struct sunxi_cedrus_driver_data *driver_data,
+	void *data)
+{
+	return false;
+}
+
+static int create_buffer(VADriverContextP context, VAContextID context_id,
+	VABufferType type, unsigned int size, VABufferID *buffer_id,
+	void **data)
+{
+	VAStatus status;
+
+	status = SunxiCedrusCreateBuffer(context, context_id, type, size, 1, NULL, buffer_id);
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	status = SunxiCedrusMapBuffer(context, *buffer_id, data);
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	memset(*data, 0, size);
+
+	return 0;
+}
+
+/* Renders a picture to the surface with the buffers a decoding loop creates. */
+static int decode_picture(VADriverContextP context, VAContextID context_id,
+	VASurfaceID surface_id, VASurfaceID reference_id, unsigned int frame)
+{
+	VABufferID buffers_ids[2 + SLICES_COUNT * 2];
+	unsigned int buffers_count = 0;
+	VAPictureParameterBufferMPEG2 *parameters;
+	VAIQMatrixBufferMPEG2 *quantization;
+	VASliceParameterBufferMPEG2 *slice_parameters;
+	unsigned char *slice_data;
+	unsigned int slice_size;
+	VAStatus status;
+	unsigned int i;
+	int rc;
+
+	status = SunxiCedrusBeginPicture(context, context_id, surface_id);
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	rc = create_buffer(context, context_id, VAPictureParameterBufferType, sizeof(*parameters), &buffers_ids[buffers_count++], (void **) &parameters);
+	if (rc < 0)
+		return -1;
+
+	parameters->horizontal_size = PICTURE_WIDTH;
+	parameters->vertical_size = PICTURE_HEIGHT;
+	parameters->forward_reference_picture = reference_id;
+	parameters->backward_reference_picture = VA_INVALID_ID;
+	parameters->picture_coding_type = reference_id == VA_INVALID_ID ? 1 : 2;
+	parameters->f_code = 0x1fff;
+	parameters->picture_coding_extension.bits.picture_structure = 3;
+	parameters->picture_coding_extension.bits.frame_pred_frame_dct = 1;
+
+	SunxiCedrusUnmapBuffer(context, buffers_ids[buffers_count - 1]);
+
+	rc = create_buffer(context, context_id, VAIQMatrixBufferType, sizeof(*quantization), &buffers_ids[buffers_count++], (void **) &quantization);
+	if (rc < 0)
+		return -1;
+
+	quantization->load_intra_quantiser_matrix = 1;
+	quantization->load_non_intra_quantiser_matrix = 1;
+	memset(quantization->intra_quantiser_matrix, 16, sizeof(quantization->intra_quantiser_matrix));
+	memset(quantization->non_intra_quantiser_matrix, 16, sizeof(quantization->non_intra_quantiser_matrix));
+
+	SunxiCedrusUnmapBuffer(context, buffers_ids[buffers_count - 1]);
+
+	for (i = 0; i < SLICES_COUNT; i++) {
+		/* Slice sizes vary from picture to picture. */
+		slice_size = 16 * 1024 + ((frame * 7919 + i * 104729) % (48 * 1024));
+
+		rc = create_buffer(context, context_id, VASliceParameterBufferType, sizeof(*slice_parameters), &buffers_ids[buffers_count++], (void **) &slice_parameters);
+		if (rc < 0)
+			return -1;
+
+		slice_parameters->slice_data_size = slice_size;
+		slice_parameters->slice_data_offset = 0;
+		slice_parameters->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+		slice_parameters->slice_vertical_position = i;
+		slice_parameters->quantiser_scale_code = 8;
+
+		SunxiCedrusUnmapBuffer(context, buffers_ids[buffers_count - 1]);
+
+		rc = create_buffer(context, context_id, VASliceDataBufferType, slice_size, &buffers_ids[buffers_count++], (void **) &slice_data);
+		if (rc < 0)
+			return -1;
+
+		/* A slice start code, followed by data without any other. */
+		memset(slice_data, 0xff, slice_size);
+		slice_data[0] = 0;
+		slice_data[1] = 0;
+		slice_data[2] = 1;
+		slice_data[3] = i + 1;
+
+		SunxiCedrusUnmapBuffer(context, buffers_ids[buffers_count - 1]);
+	}
+
+	status = SunxiCedrusRenderPicture(context, context_id, buffers_ids, buffers_count);
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	status = SunxiCedrusEndPicture(context, context_id);
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	for (i = 0; i < buffers_count; i++)
+		if (SunxiCedrusDestroyBuffer(context, buffers_ids[i]) != VA_STATUS_SUCCESS)
+			return -1;
+
+	return 0;
+}
+
+/* Completes the picture like the reactor does, before syncing the surface. */
+static int complete_picture(VADriverContextP context, VASurfaceID surface_id)
+{
+	struct sunxi_cedrus_driver_data *driver_data =
+		(struct sunxi_cedrus_driver_data *) context->pDriverData;
+	struct object_surface *surface_object;
+	VAStatus status;
+
+	surface_object = SURFACE(surface_id);
+	if (surface_object == NULL)
+		return -1;
+
+	pthread_mutex_lock(&driver_data->mutex);
+	status = surface_complete_queued(driver_data, surface_object);
+	pthread_cond_broadcast(&driver_data->cond);
+	pthread_mutex_unlock(&driver_data->mutex);
+
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	status = SunxiCedrusSyncSurface(context, surface_id);
+	if (status != VA_STATUS_SUCCESS)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Decodes the frames in a row, each one referencing the previous picture,
+ * which is only completed once the next one was submitted.
+ */
+static int decode_frames(VADriverContextP context, VAContextID context_id,
+	VASurfaceID *surfaces_ids, unsigned int first, unsigned int count,
+	unsigned int seed)
+{
+	VASurfaceID reference_id = VA_INVALID_ID;
+	VASurfaceID surface_id;
+	unsigned int i;
+	int rc;
+
+	for (i = first; i < first + count; i++) {
+		surface_id = surfaces_ids[i % SURFACES_COUNT];
+
+		rc = decode_picture(context, context_id, surface_id, reference_id, i * seed);
+		if (rc < 0)
+			return -1;
+
+		if (reference_id != VA_INVALID_ID) {
+			rc = complete_picture(context, reference_id);
+			if (rc < 0)
+				return -1;
+		}
+
+		reference_id = surface_id;
+	}
+
+	return complete_picture(context, reference_id);
+}
+
+int main(void)
+{
+	struct sunxi_cedrus_driver_data driver_data;
+	struct VADriverContext context;
+	VASurfaceID surfaces_ids[SURFACES_COUNT];
+	VAConfigID config_id;
+	VAContextID context_id;
+	pthread_condattr_t condattr;
+	unsigned long warm_allocations_count;
+	FILE *file;
+	VAStatus status;
+	int rc;
+
+	memset(&driver_data, 0, sizeof(driver_data));
+	memset(&context, 0, sizeof(context));
+	context.pDriverData = &driver_data;
+
+	object_heap_init(&driver_data.config_heap, sizeof(struct object_config), CONFIG_ID_OFFSET);
+	object_heap_init(&driver_data.context_heap, sizeof(struct object_context), CONTEXT_ID_OFFSET);
+	object_heap_init(&driver_data.surface_heap, sizeof(struct object_surface), SURFACE_ID_OFFSET);
+	object_heap_init(&driver_data.buffer_heap, sizeof(struct object_buffer), BUFFER_ID_OFFSET);
+	object_heap_init(&driver_data.image_heap, sizeof(struct object_image), IMAGE_ID_OFFSET);
+
+	rc = buffer_pool_init(&driver_data.buffer_pool);
+	if (rc < 0) {
+		fprintf(stderr, "Unable to init buffer pool\n");
+		return 1;
+	}
+
+	file = tmpfile();
+	if (file == NULL) {
+		fprintf(stderr, "Unable to create stub device\n");
+		return 1;
+	}
+
+	device.fd = fileno(file);
+
+	driver_data.video_fd = device.fd;
+	driver_data.media_fd = -1;
+	driver_data.capture_format = V4L2_PIX_FMT_MB32_NV12;
+	driver_data.epoll_fd = -1;
+	driver_data.event_fd = -1;
+
+	pthread_mutex_init(&driver_data.mutex, NULL);
+
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&driver_data.cond, &condattr);
+	pthread_condattr_destroy(&condattr);
+
+	status = SunxiCedrusCreateConfig(&context, VAProfileMPEG2Main, VAEntrypointVLD, NULL, 0, &config_id);
+	if (status != VA_STATUS_SUCCESS)
+		goto error;
+
+	status = SunxiCedrusCreateSurfaces(&context, PICTURE_WIDTH, PICTURE_HEIGHT, VA_RT_FORMAT_YUV420, SURFACES_COUNT, surfaces_ids);
+	if (status != VA_STATUS_SUCCESS)
+		goto error;
+
+	status = SunxiCedrusCreateContext(&context, config_id, PICTURE_WIDTH, PICTURE_HEIGHT, VA_PROGRESSIVE, surfaces_ids, SURFACES_COUNT, &context_id);
+	if (status != VA_STATUS_SUCCESS)
+		goto error;
+
+	/* The largest slices only show up after a few pictures. */
+	rc = decode_frames(&context, context_id, surfaces_ids, 0, FRAMES_WARMUP_COUNT, 61);
+	if (rc < 0)
+		goto error;
+
+	warm_allocations_count = allocations_count;
+
+	rc = decode_frames(&context, context_id, surfaces_ids, FRAMES_WARMUP_COUNT, FRAMES_COUNT, 1);
+	if (rc < 0)
+		goto error;
+
+	if (allocations_count != warm_allocations_count) {
+		fprintf(stderr, "%lu allocations over %u frames\n", allocations_count - warm_allocations_count, FRAMES_COUNT);
+		return 1;
+	}
+
+	SunxiCedrusDestroyContext(&context, context_id);
+	SunxiCedrusDestroySurfaces(&context, surfaces_ids, SURFACES_COUNT);
+	SunxiCedrusDestroyConfig(&context, config_id);
+
+	pthread_cond_destroy(&driver_data.cond);
+	pthread_mutex_destroy(&driver_data.mutex);
+
+	fclose(file);
+
+	buffer_pool_destroy(&driver_data.buffer_pool);
+	object_heap_destroy(&driver_data.image_heap);
+	object_heap_destroy(&driver_data.buffer_heap);
+	object_heap_destroy(&driver_data.surface_heap);
+	object_heap_destroy(&driver_data.context_heap);
+	object_heap_destroy(&driver_data.config_heap);
+
+	return 0;
+
+error:
+	fprintf(stderr, "Unable to run decoding loop\n");
+	return 1;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Compares the SIMD detilers the CPU supports with the portable ones, over
+ * widths and heights that are not multiples of the tile size or of the vector
+ * width.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tiled_yuv.h"
+
+#define PLANE_ALIGNMENT	64
+#define PITCH_MARGIN	7
+#define GUARD_BYTE	0x5a
+
+typedef void (*to_planar_t)(void *src, void *dst, unsigned int dst_pitch,
+			    unsigned int width, unsigned int height);
+typedef void (*deinterleave_t)(void *src, void *dst1, void *dst2,
+			       unsigned int dst_pitch, unsigned int width,
+			       unsigned int height);
+
+struct kernels {
+	const char *name;
+	bool supported;
+	to_planar_t to_planar;
+	deinterleave_t deinterleave;
+};
+
+static const unsigned int widths[] = { 1, 2, 3, 15, 16, 31, 32, 33, 47, 63,
+				       64, 65, 95, 127, 200, 721, 1279, 1920 };
+static const unsigned int heights[] = { 1, 2, 31, 32, 33, 63, 67, 97 };
+
+static unsigned int align(unsigned int value, unsigned int alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static int compare(const char *name, const char *kernel, unsigned int width,
+		   unsigned int height, uint8_t *expected, uint8_t *actual,
+		   unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		if (expected[i] != actual[i])
+			break;
+
+	if (i == size)
+		return 0;
+
+	fprintf(stderr, "%s_%s differs at byte %u for %ux%u\n", name, kernel, i,
+		width, height);
+
+	return -1;
+}
+
+static int check_size(struct kernels *kernels, unsigned int count,
+		      unsigned int width, unsigned int height)
+{
+	unsigned int source_size, pitch, size, i;
+	uint8_t *source = NULL;
+	uint8_t *expected = NULL;
+	uint8_t *actual = NULL;
+	int rc = -1;
+
+	source_size = align(width, TILED_YUV_TILE_WIDTH) *
+		      align(height, TILED_YUV_TILE_HEIGHT);
+	pitch = width + PITCH_MARGIN;
+	size = pitch * height * 2;
+
+	if (posix_memalign((void **) &source, PLANE_ALIGNMENT, source_size) != 0)
+		source = NULL;
+
+	expected = malloc(size);
+	actual = malloc(size);
+	if (source == NULL || expected == NULL || actual == NULL)
+		goto complete;
+
+	for (i = 0; i < source_size; i++)
+		source[i] = rand();
+
+	/* Bytes past the width of each line must be left alone. */
+	memset(expected, GUARD_BYTE, size);
+	tiled_to_planar_c(source, expected, pitch, width, height);
+
+	for (i = 0; i < count; i++) {
+		if (!kernels[i].supported)
+			continue;
+
+		memset(actual, GUARD_BYTE, size);
+		kernels[i].to_planar(source, actual, pitch, width, height);
+
+		if (compare("tiled_to_planar", kernels[i].name, width, height,
+			    expected, actual, size) < 0)
+			goto complete;
+	}
+
+	memset(expected, GUARD_BYTE, size);
+	tiled_deinterleave_to_planar_c(source, expected,
+				       expected + pitch * height, pitch, width,
+				       height);
+
+	for (i = 0; i < count; i++) {
+		if (!kernels[i].supported)
+			continue;
+
+		memset(actual, GUARD_BYTE, size);
+		kernels[i].deinterleave(source, actual, actual + pitch * height,
+					pitch, width, height);
+
+		if (compare("tiled_deinterleave_to_planar", kernels[i].name,
+			    width, height, expected, actual, size) < 0)
+			goto complete;
+	}
+
+	rc = 0;
+
+complete:
+	free(source);
+	free(expected);
+	free(actual);
+
+	return rc;
+}
+
+int main(void)
+{
+	struct kernels kernels[] = {
+#if defined(__arm__)
+		{ "neon", true, tiled_to_planar_neon,
+		  tiled_deinterleave_to_planar_neon },
+		{ "neon_blocked", true, tiled_to_planar_neon_blocked,
+		  tiled_deinterleave_to_planar_neon },
+#endif
+#if defined(__aarch64__)
+		{ "neon64", true, tiled_to_planar_neon64,
+		  tiled_deinterleave_to_planar_neon64 },
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+		{ "sse2", __builtin_cpu_supports("sse2"), tiled_to_planar_sse2,
+		  tiled_deinterleave_to_planar_sse2 },
+		{ "avx2", __builtin_cpu_supports("avx2"), tiled_to_planar_avx2,
+		  tiled_deinterleave_to_planar_avx2 },
+#endif
+		{ "c", true, tiled_to_planar_c, tiled_deinterleave_to_planar_c },
+	};
+	unsigned int count = sizeof(kernels) / sizeof(kernels[0]);
+	unsigned int i, j;
+
+	srand(1);
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++)
+		for (j = 0; j < sizeof(heights) / sizeof(heights[0]); j++)
+			if (check_size(kernels, count, widths[i], heights[j]) < 0)
+				return 1;
+
+	for (i = 0; i < count; i++)
+		printf("%s: %s\n", kernels[i].name,
+		       kernels[i].supported ? "checked" : "not supported");
+
+	return 0;
+}